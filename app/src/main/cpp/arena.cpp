@@ -0,0 +1,60 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstring>
+
+Arena::Arena(size_t initialBlockSize)
+    : current(0), offset(0), initialBlockSize(initialBlockSize) {}
+
+void Arena::addBlock(size_t minimumSize) {
+    size_t size = blocks.empty() ? initialBlockSize : blocks.back().size * 2;
+    size = std::max(size, minimumSize);
+    blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+    current = blocks.size() - 1;
+    offset = 0;
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+    if (size == 0) size = 1;
+    while (true) {
+        if (current < blocks.size()) {
+            Block& block = blocks[current];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+            uintptr_t aligned = (base + offset + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+            size_t start = aligned - base;
+            if (start + size <= block.size) {
+                offset = start + size;
+                return block.data.get() + start;
+            }
+            if (current + 1 < blocks.size()) {
+                ++current;
+                offset = 0;
+                continue;
+            }
+        }
+        addBlock(size + alignment);
+    }
+}
+
+std::string_view Arena::copy(std::string_view text) {
+    if (text.empty()) return std::string_view();
+    char* dest = static_cast<char*>(allocate(text.size(), 1));
+    std::memcpy(dest, text.data(), text.size());
+    return std::string_view(dest, text.size());
+}
+
+void Arena::reset() {
+    if (blocks.size() > 1) {
+        const size_t total = capacity();
+        blocks.clear();
+        addBlock(total);
+    }
+    current = 0;
+    offset = 0;
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const auto& block : blocks) total += block.size;
+    return total;
+}
@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Monotonic allocator for per-assembly data. Allocations are never freed one by one:
+// reset() releases everything at once and keeps the memory for the next assembly, so a
+// reused Assembler stops touching the heap once the arena has grown to its working size.
+class Arena {
+public:
+    explicit Arena(size_t initialBlockSize = 64 * 1024);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    std::string_view copy(std::string_view text);
+
+    // Drops every allocation. If the last assembly spilled into several blocks they are
+    // merged into one block big enough to hold all of it.
+    void reset();
+
+    size_t capacity() const;
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current;
+    size_t offset;
+    size_t initialBlockSize;
+
+    void addBlock(size_t minimumSize);
+};
+
+// Allocator adaptor so node-based standard containers can live in an Arena.
+// deallocate() is a no-op; memory comes back when the arena is reset.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+    Arena* arena;
+};
+
+#endif // ARENA_H
@@ -1,24 +1,260 @@
 #include "assembler.h"
+#include "line_scanner.h"
 #include "utils.h"
 #include <sstream>
+#include <atomic>
+#include <thread>
 #include <iomanip>
 #include <iostream>
 #include <algorithm>
 #include <cctype>
 #include <set>
 #include <stdexcept>
+#include <chrono>
+#include <cstdio>
 
-Assembler::Assembler() {
+namespace {
+
+// Added to one relocation base while probing how an expression depends on it.
+const int32_t kRelocationProbe = 0x4000;
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+AllocationCounter gAllocationCounter = nullptr;
+
+uint64_t allocationCount() {
+    return gAllocationCounter ? gAllocationCounter() : 0;
+}
+
+const char kHexDigits[] = "0123456789ABCDEF";
+
+void appendHexByte(std::string& out, uint8_t value) {
+    out += kHexDigits[value >> 4];
+    out += kHexDigits[value & 0x0F];
+}
+
+void appendHexWord(std::string& out, uint16_t value) {
+    appendHexByte(out, static_cast<uint8_t>(value >> 8));
+    appendHexByte(out, static_cast<uint8_t>(value & 0xFF));
+}
+
+const uint32_t kMemorySize = 0x10000;
+
+// Fewer lines than this per chunk are not worth a thread.
+const size_t kParallelChunkLines = 8192;
+
+// Runs task(0) .. task(count - 1) on up to `threads` threads, the caller included, each
+// thread taking the next pending index.
+void runTasks(size_t count, unsigned threads, const std::function<void(size_t)>& task) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) task(i);
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < std::min<size_t>(threads, count); ++t) pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool) thread.join();
+}
+
+// Removes "//" and ';' comments and surrounding whitespace. `marks` are the line's
+// LineMark bits; a search the scanner already ruled out is skipped.
+std::string_view stripComment(std::string_view line, uint8_t marks = LINE_HAS_ANY) {
+    size_t commentPos = (marks & LINE_HAS_SLASH) ? line.find("//") : std::string_view::npos;
+    if (commentPos != std::string_view::npos) line = line.substr(0, commentPos);
+    commentPos = (marks & LINE_HAS_SEMICOLON) ? line.find(';') : std::string_view::npos;
+    if (commentPos != std::string_view::npos) line = line.substr(0, commentPos);
+    return trimView(line);
+}
+
+size_t findColon(std::string_view line, uint8_t marks) {
+    return (marks & LINE_HAS_COLON) ? line.find(':') : std::string_view::npos;
+}
+
+// Estimated cycles of an instruction `length` bytes long starting with `opcode`. There is
+// no measured timing table for the machine, so this is a model: one cycle per byte fetched,
+// one more per byte of data loaded, stored, pushed or popped, and one internal cycle for the
+// operation itself (sixteen for the bit-serial SQRT, MULx and DIVx). The listing's cycle
+// column, the cycle regions and the optimizer's savings all use it.
+uint32_t estimateCycles(uint8_t opcode, uint32_t length) {
+    uint32_t data = 0;
+    uint32_t internal = 1;
+    if (opcode >= 0x80 && opcode <= 0xBF) data = (opcode & 0x04) ? 1 : 2; // LD/ST through memory
+    else if ((opcode >= 0xC0 && opcode <= 0xC4) || (opcode >= 0xC8 && opcode <= 0xCC)) data = 2; // POP, PUSH
+    else if (opcode == 0xC6 || opcode == 0xCE || opcode == 0xCF) data = 2; // RET, JSR: the return address
+    else if (opcode == 0xC7 || opcode == 0xCD) data = 4; // RETI, TRAP: return address and PS
+    else if (opcode >= 0xF7 && opcode <= 0xFB) internal = 16;
+    return length + data + internal;
+}
+
+bool isQuoted(std::string_view t) {
+    return t.size() >= 2 && ((t.front() == '"' && t.back() == '"') || (t.front() == '\'' && t.back() == '\''));
+}
+
+// Removes /* */ comments, carrying the open-comment state across lines. Returns `line`
+// itself when there is nothing to remove; otherwise the text is rebuilt in `cleaned`.
+std::string_view removeBlockComments(std::string_view line, bool& inBlockComment, std::string& cleaned,
+                                     uint8_t marks = LINE_HAS_ANY) {
+    if (!inBlockComment) {
+        if ((marks & LINE_HAS_SLASH) == 0) return line;
+        // Fast path: nothing to strip unless a "/*" appears before any "//".
+        size_t slash = line.find('/');
+        while (slash != std::string_view::npos) {
+            char next = (slash + 1 < line.size()) ? line[slash + 1] : '\n';
+            if (next == '/') return line;
+            if (next == '*') break;
+            slash = line.find('/', slash + 1);
+        }
+        if (slash == std::string_view::npos) return line;
+    }
+
+    cleaned.clear();
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        char next = (i + 1 < line.size()) ? line[i + 1] : '\n';
+
+        if (inBlockComment) {
+            if (c == '*' && next == '/') {
+                inBlockComment = false;
+                ++i;
+            }
+            continue;
+        }
+
+        if (c == '/' && next == '/') {
+            // Keep whole line-comment text as-is for listing fidelity.
+            cleaned.append(line.substr(i));
+            break;
+        }
+
+        if (c == '/' && next == '*') {
+            inBlockComment = true;
+            ++i;
+            continue;
+        }
+
+        cleaned += c;
+    }
+    return cleaned;
+}
+
+// Returns the include operand of `line` (comments already removed) if the line is an
+// INCLUDE directive, with surrounding quotes and a trailing ';' dropped.
+bool parseIncludeOperand(std::string_view line, std::string_view& operand) {
+    std::string_view rest = stripComment(line);
+    if (rest.empty() || !equalsIgnoreCase(nextToken(rest), "INCLUDE")) return false;
+    std::string_view token = trimView(rest);
+    if (!token.empty() && token.back() == ';') token.remove_suffix(1);
+    token = trimView(token);
+    if (isQuoted(token)) {
+        token = token.substr(1, token.size() - 2);
+    }
+    operand = trimView(token);
+    return true;
+}
+
+bool isWordChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Cheap whole-word check for MACRO, REPT or ENDIF. Sources without any of them cannot use
+// the directive preprocessor, so it is skipped entirely for them.
+bool hasPreprocessorKeywords(std::string_view text) {
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (!std::isalpha(static_cast<unsigned char>(text[i])) || (i > 0 && isWordChar(text[i - 1]))) continue;
+        size_t end = i + 1;
+        while (end < text.size() && isWordChar(text[end])) ++end;
+        std::string_view word = text.substr(i, end - i);
+        if (equalsIgnoreCase(word, "MACRO") || equalsIgnoreCase(word, "REPT") || equalsIgnoreCase(word, "ENDIF")) {
+            return true;
+        }
+        i = end;
+    }
+    return false;
+}
+
+} // namespace
+
+std::vector<IncludeDirective> scanIncludeDirectives(std::string_view text) {
+    std::vector<IncludeDirective> directives;
+    std::string cleaned;
+    bool inBlockComment = false;
+    size_t start = 0;
+    for (uint32_t index = 0; start < text.size(); ++index) {
+        size_t end = text.find('\n', start);
+        if (end == std::string_view::npos) end = text.size();
+        std::string_view operand;
+        if (parseIncludeOperand(removeBlockComments(text.substr(start, end - start), inBlockComment, cleaned), operand)) {
+            directives.push_back({index, std::string(operand), toUpper(std::string(operand))});
+        }
+        start = end + 1;
+    }
+    return directives;
+}
+
+Assembler::Assembler()
+    : symbolTable(std::less<>(), SymbolTable::allocator_type(&arena)), currentAddress(0), stats() {
     initOpcodes();
 }
 
 void Assembler::setIncludeFiles(const std::map<std::string, std::string>& includeFiles) {
+    includeGraph.clear();
+    includeFileStorage.clear();
+    includeFileContents.clear();
+    for (const auto& entry : includeFiles) {
+        const std::string name = toUpper(trim(entry.first));
+        std::string& stored = includeFileStorage[name];
+        stored = entry.second;
+        includeFileContents[name] = stored;
+    }
+}
+
+void Assembler::setIncludeBuffers(const std::map<std::string, std::string_view>& includeFiles) {
+    includeGraph.clear();
+    includeFileStorage.clear();
     includeFileContents.clear();
     for (const auto& entry : includeFiles) {
         includeFileContents[toUpper(trim(entry.first))] = entry.second;
     }
 }
 
+void InstructionTable::clear() {
+    address.clear();
+    lineIndex.clear();
+    byteOffset.clear();
+    length.clear();
+    flags.clear();
+    bytes.clear();
+}
+
+void InstructionTable::reserve(size_t entries) {
+    address.reserve(entries);
+    lineIndex.reserve(entries);
+    byteOffset.reserve(entries);
+    length.reserve(entries);
+    flags.reserve(entries);
+}
+
+void InstructionTable::add(uint16_t entryAddress, size_t line, size_t firstByte, uint8_t entryFlags) {
+    address.push_back(entryAddress);
+    lineIndex.push_back(static_cast<uint32_t>(line));
+    byteOffset.push_back(static_cast<uint32_t>(firstByte));
+    length.push_back(static_cast<uint32_t>(bytes.size() - firstByte));
+    flags.push_back(entryFlags);
+}
+
+void InstructionTable::addFill(uint16_t entryAddress, size_t line, uint8_t value, uint32_t count) {
+    address.push_back(entryAddress);
+    lineIndex.push_back(static_cast<uint32_t>(line));
+    byteOffset.push_back(static_cast<uint32_t>(bytes.size()));
+    length.push_back(count);
+    flags.push_back(FILL);
+    bytes.push_back(value);
+}
+
 void Assembler::initOpcodes() {
     // Reference: http://www.megaprocessor.com/instruction_set.pdf
 
@@ -64,22 +300,56 @@ void Assembler::initOpcodes() {
     opcodeMap["NOP"] = 0xFF;
 }
 
-int Assembler::parseRegister(const std::string& token) {
-    std::string t = toUpper(trim(token));
-    while (!t.empty() && (t.back() == ',' || t.back() == ';' || t.back() == ')' || t.back() == ' ')) t.pop_back();
-    while (!t.empty() && (t.front() == '(' || t.front() == ' ')) t.erase(0, 1);
-    t = trim(t);
+namespace {
+
+// Mnemonics encoded by dedicated code in pass2Line rather than looked up in opcodeMap.
+const char* const kEncodedMnemonics[] = {
+    "LD.B", "LD.W", "ST.B", "ST.W", "MOVE", "AND", "XOR", "OR", "ADD", "SUB", "CMP", "TEST", "SXT", "ABS",
+    "INV", "NEG", "CLR", "INC", "DEC", "ADDQ", "ASL", "ASR", "LSL", "LSR", "ROL", "ROR", "ROXL", "ROXR",
+    "BTST", "BCHG", "BCLR", "BSET"};
+
+const char* const kDirectives[] = {
+    "ORG", "EQU", "DB", "DW", "DL", "DM", "DS", "INCLUDE", "MACRO", "ENDM", "REPT", "ENDR", "IF", "ELSE",
+    "ENDIF", "SECTION", "GLOBAL", "EXTERN"};
+
+} // namespace
+
+bool Assembler::isMnemonic(std::string_view word) const {
+    char upper[16];
+    if (word.empty() || word.size() > sizeof(upper)) return false;
+    for (size_t i = 0; i < word.size(); ++i) upper[i] = static_cast<char>(std::toupper(static_cast<unsigned char>(word[i])));
+    std::string_view name(upper, word.size());
+    if (name.size() > 3 && name.substr(name.size() - 3) == ".WT") name.remove_suffix(3);
+    if (opcodeMap.find(name) != opcodeMap.end()) return true;
+    for (const char* mnemonic : kEncodedMnemonics) {
+        if (name == mnemonic) return true;
+    }
+    return false;
+}
+
+bool Assembler::isDirective(std::string_view word) {
+    for (const char* directive : kDirectives) {
+        if (equalsIgnoreCase(word, directive)) return true;
+    }
+    return false;
+}
 
-    if (t == "R0") return 0;
-    if (t == "R1") return 1;
-    if (t == "R2") return 2;
-    if (t == "R3") return 3;
-    if (t == "PS") return 4;
-    if (t == "SP") return 5; 
+int Assembler::parseRegister(std::string_view token) {
+    std::string_view t = trimView(token);
+    while (!t.empty() && (t.back() == ',' || t.back() == ';' || t.back() == ')' || t.back() == ' ')) t.remove_suffix(1);
+    while (!t.empty() && (t.front() == '(' || t.front() == ' ')) t.remove_prefix(1);
+    t = trimView(t);
+
+    if (equalsIgnoreCase(t, "R0")) return 0;
+    if (equalsIgnoreCase(t, "R1")) return 1;
+    if (equalsIgnoreCase(t, "R2")) return 2;
+    if (equalsIgnoreCase(t, "R3")) return 3;
+    if (equalsIgnoreCase(t, "PS")) return 4;
+    if (equalsIgnoreCase(t, "SP")) return 5;
     return -1;
 }
 
-uint8_t Assembler::getALUOpcode(const std::string& mnemonic, int ra, int rb) {
+uint8_t Assembler::getALUOpcode(std::string_view mnemonic, int ra, int rb) {
     if (ra < 0 || rb < 0 || ra > 3 || rb > 3) return 0xFF;
 
     const uint8_t regCode = static_cast<uint8_t>(rb * 4 + ra);
@@ -95,12 +365,12 @@ uint8_t Assembler::getALUOpcode(const std::string& mnemonic, int ra, int rb) {
     return 0xFF;
 }
 
-void Assembler::encodeALU(const std::string& mnemonic, const std::string& op1, const std::string& op2,
+void Assembler::encodeALU(std::string_view mnemonic, std::string_view op1, std::string_view op2,
                            std::vector<uint8_t>& bytes, int lineNum, std::string& error) {
     int r1 = parseRegister(op1);
     
     if (mnemonic == "INC" || mnemonic == "DEC") {
-        if (r1 < 0 || r1 > 3) { error = "Invalid register in " + mnemonic + " at line " + std::to_string(lineNum); return; }
+        if (r1 < 0 || r1 > 3) { error = diagnose("E_REGISTER", op1, "Invalid register in " + std::string(mnemonic) + " at line " + std::to_string(lineNum)); return; }
         bytes.push_back((mnemonic == "INC" ? 0x54 : 0x5C) + r1);
         return;
     }
@@ -108,14 +378,14 @@ void Assembler::encodeALU(const std::string& mnemonic, const std::string& op1, c
     if (mnemonic == "ADDQ") {
         int r = r1;
         int32_t val;
-        std::string valStr = op2;
-        if (!valStr.empty() && valStr[0] == '#') valStr = valStr.substr(1);
+        std::string_view valStr = op2;
+        if (!valStr.empty() && valStr[0] == '#') valStr.remove_prefix(1);
         if (!evaluateExpression(valStr, val)) {
-            error = "Invalid ADDQ value at line " + std::to_string(lineNum) + ": " + expressionError;
+            error = diagnose("E_EXPRESSION", op2, "Invalid ADDQ value at line " + std::to_string(lineNum) + ": " + expressionError());
             return;
         }
         if (r < 0 || r > 3 || (val != 1 && val != 2 && val != -1 && val != -2)) {
-            error = "ADDQ supports only #1/#2/#-1/#-2 for registers R0-R3 at line " + std::to_string(lineNum);
+            error = diagnose("E_VALUE_RANGE", op2, "ADDQ supports only #1/#2/#-1/#-2 for registers R0-R3 at line " + std::to_string(lineNum));
             return;
         }
         if (val ==  1) bytes.push_back(0x54 + r);
@@ -129,7 +399,7 @@ void Assembler::encodeALU(const std::string& mnemonic, const std::string& op1, c
     
     // Single operand ALU ops
     if (mnemonic == "SXT" || mnemonic == "ABS" || mnemonic == "INV" || mnemonic == "NEG" || mnemonic == "CLR" || mnemonic == "TEST") {
-        if (r1 < 0 || r1 > 3) { error = "Invalid register in " + mnemonic + " at line " + std::to_string(lineNum); return; }
+        if (r1 < 0 || r1 > 3) { error = diagnose("E_REGISTER", op1, "Invalid register in " + std::string(mnemonic) + " at line " + std::to_string(lineNum)); return; }
         bytes.push_back(getALUOpcode(mnemonic, r1, r1));
         return;
     }
@@ -149,18 +419,18 @@ void Assembler::encodeALU(const std::string& mnemonic, const std::string& op1, c
         if (code != 0xFF) {
             bytes.push_back(code);
         } else {
-            error = "Invalid operands or mnemonic " + mnemonic + " at line " + std::to_string(lineNum);
+            error = diagnose("E_OPERAND", op1, "Invalid operands or mnemonic " + std::string(mnemonic) + " at line " + std::to_string(lineNum));
         }
     } else {
-        error = "Invalid register(s) for " + mnemonic + " at line " + std::to_string(lineNum);
+        error = diagnose("E_REGISTER", op1, "Invalid register(s) for " + std::string(mnemonic) + " at line " + std::to_string(lineNum));
     }
 }
 
-void Assembler::encodeBitOp(const std::string& mnemonic, const std::string& op1, const std::string& op2,
+void Assembler::encodeBitOp(std::string_view mnemonic, std::string_view op1, std::string_view op2,
                              std::vector<uint8_t>& bytes, int lineNum, std::string& error) {
     int r1 = parseRegister(op1);
     if (r1 < 0 || r1 > 3) {
-        error = "Invalid destination register for bit operation at line " + std::to_string(lineNum);
+        error = diagnose("E_REGISTER", op1, "Invalid destination register for bit operation at line " + std::to_string(lineNum));
         return;
     }
 
@@ -178,11 +448,11 @@ void Assembler::encodeBitOp(const std::string& mnemonic, const std::string& op1,
         opByte |= (r2 & 0x03);
     } else {
         // Immediate mode
-        std::string valStr = op2;
-        if (!valStr.empty() && valStr[0] == '#') valStr = valStr.substr(1);
+        std::string_view valStr = op2;
+        if (!valStr.empty() && valStr[0] == '#') valStr.remove_prefix(1);
         int32_t bitNum;
         if (!evaluateExpression(valStr, bitNum)) {
-            error = "Invalid bit number at line " + std::to_string(lineNum) + ": " + expressionError;
+            error = diagnose("E_EXPRESSION", op2, "Invalid bit number at line " + std::to_string(lineNum) + ": " + expressionError());
             return;
         }
         opByte |= (bitNum & 0x1F);
@@ -219,8 +489,8 @@ int32_t Assembler::parseTerm(const char*& p) {
         } else if (*p == '/') {
             p++;
             int32_t y = parseFactor(p);
-            if (y == 0) throw std::runtime_error("Division by zero in expression");
-            x /= y;
+            if (y == 0 && unresolvedSymbol.empty()) throw std::runtime_error("Division by zero in expression");
+            x = y == 0 ? 0 : x / y;
         }
     }
     return x;
@@ -243,748 +513,2066 @@ int32_t Assembler::parseFactor(const char*& p) {
     }
     if (*p == '$') {
         p++;
-        return static_cast<int32_t>(currentAddress);
+        noteBase(currentSection);
+        return static_cast<int32_t>(currentAddress) + (currentSection != 0 && currentSection == probeBase ? kRelocationProbe : 0);
     }
-    if (isdigit(*p)) {
-        std::string numStr;
+    if (isdigit(static_cast<unsigned char>(*p))) {
+        int base = 10;
         if (*p == '0' && (toupper(*(p+1)) == 'X')) {
             p += 2;
-            while (isxdigit(*p)) numStr += *p++;
-            if (numStr.empty()) throw std::runtime_error("Invalid hex literal");
-            // Use stoul to avoid overflow for values like 0xDEADBEEF
-            return static_cast<int32_t>(std::stoul(numStr, nullptr, 16));
-        }
-        if (*p == '0' && (toupper(*(p+1)) == 'B')) {
+            base = 16;
+        } else if (*p == '0' && (toupper(*(p+1)) == 'B')) {
             p += 2;
-            while (*p == '0' || *p == '1') numStr += *p++;
-            if (numStr.empty()) throw std::runtime_error("Invalid binary literal");
-            return static_cast<int32_t>(std::stoul(numStr, nullptr, 2));
-        }
-        while (isdigit(*p)) numStr += *p++;
-        return static_cast<int32_t>(std::stoul(numStr));
-    }
-    if (isalpha(*p) || *p == '_') {
-        std::string symName;
-        while (isalnum(*p) || *p == '_') symName += *p++;
-        std::string key = toUpper(symName);
-        auto it = symbolTable.find(key);
-        if (it != symbolTable.end() && it->second.isDefined) {
-            return it->second.value;
-        }
-        std::string msg = "Undefined symbol: " + symName;
-        // Collect a few symbols for diagnosis if not too many
-        msg += " (Symbols defined: ";
-        int count = 0;
-        for (auto const& [k, v] : symbolTable) {
-            if (v.isDefined) {
-                msg += k + " ";
-                if (++count > 50) { msg += "..."; break; }
-            }
+            base = 2;
+        }
+        const char* digitsStart = p;
+        unsigned long long value = 0;
+        while (true) {
+            int digit;
+            if (base == 16 && isxdigit(static_cast<unsigned char>(*p))) digit = isdigit(static_cast<unsigned char>(*p)) ? *p - '0' : toupper(*p) - 'A' + 10;
+            else if (base == 2 && (*p == '0' || *p == '1')) digit = *p - '0';
+            else if (base == 10 && isdigit(static_cast<unsigned char>(*p))) digit = *p - '0';
+            else break;
+            if (value > (~0ULL - digit) / base) throw std::runtime_error("Numeric literal out of range");
+            value = value * base + digit;
+            p++;
         }
-        msg += ")";
-        throw std::runtime_error(msg);
+        if (p == digitsStart) {
+            throw std::runtime_error(base == 16 ? "Invalid hex literal" : "Invalid binary literal");
+        }
+        return static_cast<int32_t>(value);
+    }
+    if (isalpha(static_cast<unsigned char>(*p)) || *p == '_') {
+        const char* nameStart = p;
+        while (isalnum(static_cast<unsigned char>(*p)) || *p == '_') p++;
+        std::string_view symName(nameStart, static_cast<size_t>(p - nameStart));
+        const Symbol* symbol = findSymbol(symName);
+        if (symbol != nullptr && symbol->isDefined) {
+            noteBase(symbol->base);
+            return symbol->value + (symbol->base != 0 && symbol->base == probeBase ? kRelocationProbe : 0);
+        }
+        // Only the first undefined symbol is kept; the rest of the expression is still
+        // parsed so a syntax error after it is reported like before.
+        if (unresolvedSymbol.empty()) unresolvedSymbol = symName;
+        return 0;
     }
     throw std::runtime_error("Unexpected character in expression");
 }
 
-bool Assembler::evaluateExpression(const std::string& expr, int32_t& result) {
-    std::string cleanExpr;
-    for (char c : expr) if (!isspace(c)) cleanExpr += c;
+bool Assembler::evaluateExpression(std::string_view expr, int32_t& result) {
+    stats.expressionEvaluations++;
+    std::string& cleanExpr = expressionBuffer;
+    cleanExpr.clear();
+    for (char c : expr) if (!isspace(static_cast<unsigned char>(c))) cleanExpr += c;
     
+    unresolvedSymbol = std::string_view();
     if (cleanExpr.empty()) {
-        expressionError = "Empty expression";
+        expressionFailure = "Empty expression";
         return false;
     }
     if (cleanExpr.back() == ';') cleanExpr.pop_back();
 
     const char* p = cleanExpr.c_str();
+    seenBaseCount = 0;
+    expressionBase = 0;
     try {
         result = parseExpression(p);
         if (*p != '\0') {
              // In case there's something left after parsing
              // expressionError = "Unexpected characters"; 
         }
-        return true;
     } catch (const std::exception& e) {
-        expressionError = e.what();
+        if (!unresolvedSymbol.empty()) return false;
+        expressionFailure = e.what();
         return false;
     }
+    if (!unresolvedSymbol.empty()) return false;
+    if (seenBaseCount == 0) return true;
+
+    // The value involves relocatable symbols. Re-evaluating with one base moved by a probe
+    // shows how the result depends on it: not at all (e.g. the difference of two labels in
+    // one section), exactly one-to-one (symbol plus or minus a constant), or some other way,
+    // which the linker could not patch.
+    const size_t baseCount = seenBaseCount;
+    for (size_t i = 0; i < baseCount; ++i) {
+        probeBase = seenBases[i];
+        p = cleanExpr.c_str();
+        int32_t moved = result + 1;
+        try {
+            moved = parseExpression(p);
+        } catch (const std::exception&) {
+        }
+        probeBase = 0;
+        if (moved == result) continue;
+        if (moved - result != kRelocationProbe || expressionBase != 0) {
+            expressionBase = 0;
+            expressionFailure = "Expression is not relocatable (only symbol +/- constant can be linked)";
+            return false;
+        }
+        expressionBase = seenBases[i];
+    }
+    if (expressionBase != 0) pendingRelocation = expressionBase;
+    return true;
 }
 
-std::string Assembler::normalizeIncludeName(const std::string& includeToken) const {
-    std::string token = trim(includeToken);
-    if (!token.empty() && token.back() == ';') token.pop_back();
-    token = trim(token);
-    if (token.size() >= 2 && ((token.front() == '"' && token.back() == '"') || (token.front() == '\'' && token.back() == '\''))) {
-        token = token.substr(1, token.size() - 2);
+std::string Assembler::expressionError() const {
+    if (unresolvedSymbol.empty()) return expressionFailure;
+    std::string msg = "Undefined symbol: " + std::string(unresolvedSymbol);
+    // Collect a few symbols for diagnosis if not too many
+    msg += " (Symbols defined: ";
+    int count = 0;
+    for (auto const& [k, v] : owner->symbolTable) {
+        if (v.isDefined) {
+            msg += std::string(k) + " ";
+            if (++count > 50) { msg += "..."; break; }
+        }
     }
-    return toUpper(trim(token));
+    msg += ")";
+    return msg;
 }
 
-std::vector<std::string> Assembler::preprocessIncludes(const std::vector<std::string>& rawLines, std::string& error,
-                                                       std::vector<std::string>& includeStack) const {
-    std::string fullSource;
-    for (const auto& line : rawLines) fullSource += line + "\n";
+void Assembler::noteBase(uint16_t base) {
+    if (base == 0 || probeBase != 0) return;
+    for (size_t i = 0; i < seenBaseCount; ++i) {
+        if (seenBases[i] == base) return;
+    }
+    if (seenBaseCount == sizeof(seenBases) / sizeof(seenBases[0])) {
+        throw std::runtime_error("Too many relocatable symbols in expression");
+    }
+    seenBases[seenBaseCount++] = base;
+}
+
+// Called just before a 16-bit address field is appended: a relocatable value on this line
+// becomes a relocation record for that field.
+void Assembler::noteRelocation() {
+    if (pendingRelocation == 0) return;
+    relocations.push_back({currentSection, static_cast<uint16_t>(currentAddress + (instructions.bytes.size() - lineFirstByte)),
+                           pendingRelocation});
+    pendingRelocation = 0;
+}
+
+Symbol& Assembler::defineSymbol(std::string_view name) {
+    toUpperInto(name, symbolKey);
+    auto it = symbolTable.find(std::string_view(symbolKey));
+    if (it == symbolTable.end()) {
+        it = symbolTable.emplace(arena.copy(symbolKey), Symbol{name, 0, LABEL, false}).first;
+    }
+    return it->second;
+}
+
+const Symbol* Assembler::findSymbol(std::string_view name) {
+    toUpperInto(name, symbolKey);
+    auto it = owner->symbolTable.find(std::string_view(symbolKey));
+    return it == owner->symbolTable.end() ? nullptr : &it->second;
+}
+
+std::string_view Assembler::stripBlockComments(std::string_view line, bool& inBlockComment) {
+    std::string_view cleaned = removeBlockComments(line, inBlockComment, scratch, pendingMarks);
+    return cleaned.data() == line.data() ? cleaned : arena.copy(cleaned);
+}
+
+void Assembler::preprocessIncludes(const std::vector<std::string_view>& rawLines, const std::vector<uint8_t>& marks,
+                                   const std::vector<IncludeDirective>* directives,
+                                   std::vector<std::string_view>& expanded) {
+    // Directives can skip or repeat INCLUDE lines, so the host's per-line list no longer
+    // lines up with what gets expanded; every line is parsed instead.
+    if (preprocessorActive) directives = nullptr;
 
-    std::string cleaned;
     bool inBlockComment = false;
-    bool inLineComment = false;
-    for (size_t i = 0; i < fullSource.size(); ++i) {
-        char c = fullSource[i];
-        char next = (i + 1 < fullSource.size()) ? fullSource[i + 1] : '\0';
+    size_t nextDirective = 0;
+    for (size_t index = 0; index < rawLines.size(); ++index) {
+        pendingMarks = marks[index];
+        pendingSourceLine = static_cast<uint32_t>(index) + 1;
+        std::string_view line = stripBlockComments(rawLines[index], inBlockComment);
+        if (preprocessorActive && preprocessDirective(line, expanded)) continue;
+        emitLine(line, LINE_SOURCE, expanded);
+
+        // With a scanned include graph the directives are already known; otherwise each
+        // line is parsed here.
+        if (directives != nullptr) {
+            if (nextDirective >= directives->size() || (*directives)[nextDirective].line != index) continue;
+            includeKey = (*directives)[nextDirective++].name;
+        } else {
+            std::string_view operand;
+            if (!parseIncludeOperand(line, operand)) continue;
+            toUpperInto(operand, includeKey);
+        }
+        expandInclude(line, expanded);
+    }
 
-        if (inBlockComment) {
-            if (c == "*"[0] && next == "/"[0]) {
-                inBlockComment = false;
-                ++i;
-            } else if (c == '\n') {
-                cleaned += '\n';
+    // Every file contributes one trailing empty line, as the original newline-joined expansion did.
+    pendingMarks = 0;
+    if (!rawLines.empty()) emitLine(std::string_view(), LINE_SOURCE, expanded);
+}
+
+void Assembler::emitLine(std::string_view line, LineKind kind, std::vector<std::string_view>& expanded) {
+    expanded.push_back(line);
+    expandedMarks.push_back(pendingMarks);
+    expandedSourceLines.push_back(pendingSourceLine);
+    if (preprocessorActive) lineKinds.push_back(kind);
+}
+
+// Expands the file named by includeKey after its INCLUDE line, which is already emitted.
+// A missing or recursive include is reported and skipped; the rest still assembles.
+void Assembler::expandInclude(std::string_view line, std::vector<std::string_view>& expanded) {
+    auto it = includeFileContents.find(std::string_view(includeKey));
+    if (it == includeFileContents.end()) {
+        reportError(static_cast<int>(expanded.size()), line,
+                    diagnose("E_INCLUDE_NOT_FOUND", line, "Include file not found: " + includeKey));
+        return;
+    }
+
+    std::string_view includeName = it->first;
+    if (std::find(includeStack.begin(), includeStack.end(), includeName) != includeStack.end()) {
+        reportError(static_cast<int>(expanded.size()), line,
+                    diagnose("E_INCLUDE_RECURSIVE", line, "Recursive include detected: " + includeKey));
+        return;
+    }
+
+    const size_t depth = includeStack.size();
+    includeStack.push_back(includeName);
+    stats.includesExpanded++;
+    if (includeLines.size() <= depth) {
+        includeLines.resize(depth + 1);
+        includeMarks.resize(depth + 1);
+    }
+    scanLines(it->second, includeLines[depth], includeMarks[depth]);
+    const uint32_t includingLine = pendingSourceLine;
+    fileRuns.push_back({static_cast<uint32_t>(expanded.size()), includeName});
+    preprocessIncludes(includeLines[depth], includeMarks[depth], findIncludeDirectives(includeName), expanded);
+    includeStack.pop_back();
+    pendingSourceLine = includingLine;
+    fileRuns.push_back({static_cast<uint32_t>(expanded.size()), depth == 0 ? std::string_view() : includeStack.back()});
+}
+
+// Handles MACRO/ENDM, REPT/ENDR, IF/ELSE/ENDIF and macro calls. Returns true when the line
+// was consumed (emitted here, together with whatever it expands to); false for ordinary
+// lines, which the caller emits and checks for INCLUDE.
+bool Assembler::preprocessDirective(std::string_view line, std::vector<std::string_view>& expanded) {
+    std::string_view statement = stripComment(line, pendingMarks);
+    size_t colonPos = findColon(statement, pendingMarks);
+    if (colonPos != std::string_view::npos) statement = trimView(statement.substr(colonPos + 1));
+    std::string_view operands = statement;
+    std::string_view first = nextToken(operands);
+    std::string_view secondRest = operands;
+    std::string_view second = nextToken(secondRest);
+    operands = trimView(operands);
+    const int lineNum = static_cast<int>(expanded.size()) + 1;
+
+    // Inside a MACRO or REPT body lines are only collected; nested blocks are counted so the
+    // matching ENDM/ENDR closes the capture.
+    if (captureDepth > 0) {
+        if (equalsIgnoreCase(second, "MACRO") || equalsIgnoreCase(first, "REPT")) {
+            ++captureDepth;
+        } else if ((equalsIgnoreCase(first, "ENDM") || equalsIgnoreCase(first, "ENDR")) && --captureDepth == 0) {
+            if (captureMacro != nullptr) {
+                captureMacro = nullptr;
+                emitLine(line, LINE_SKIPPED, expanded);
+                return true;
             }
-            continue;
+            emitLine(line, LINE_LABEL_ONLY, expanded);
+            std::vector<std::string_view> body;
+            body.swap(repeatBody);
+            const int32_t count = repeatCount;
+            for (int32_t i = 0; i < count; ++i) replayLines(body, nullptr, {}, expanded);
+            return true;
         }
+        (captureMacro != nullptr ? captureMacro->body : repeatBody).push_back(line);
+        emitLine(line, LINE_SKIPPED, expanded);
+        return true;
+    }
 
-        if (c == '/' && next == '/') {
-            // Keep whole line-comment text as-is for listing fidelity.
-            cleaned += c;
-            cleaned += next;
-            ++i;
-            while (i + 1 < fullSource.size() && fullSource[i + 1] != '\n') {
-                cleaned += fullSource[i + 1];
-                ++i;
+    const bool active = conditionals.empty() || conditionals.back().active;
+    if (equalsIgnoreCase(first, "IF")) {
+        Conditional block = {lineNum, active, false, false};
+        emitLine(line, active ? LINE_LABEL_ONLY : LINE_SKIPPED, expanded);
+        if (active) {
+            int32_t value = 0;
+            if (!evaluateExpression(operands, value)) {
+                reportError(lineNum, line, diagnose("E_EXPRESSION", operands, "Invalid IF expression at line " +
+                                                    std::to_string(lineNum) + ": " + expressionError() +
+                                                    unresolvedEquNote(operands)));
             }
-            continue;
+            block.active = block.taken = (value != 0);
         }
-
-        if (c == '/' && next == '*') {
-            inBlockComment = true;
-            ++i;
-            continue;
+        conditionals.push_back(block);
+        return true;
+    }
+    if (equalsIgnoreCase(first, "ELSE") || equalsIgnoreCase(first, "ENDIF")) {
+        const bool isElse = equalsIgnoreCase(first, "ELSE");
+        if (conditionals.empty()) {
+            emitLine(line, LINE_SKIPPED, expanded);
+            reportError(lineNum, line, diagnose("E_CONDITIONAL", first, std::string(isElse ? "ELSE" : "ENDIF") +
+                                                " without IF at line " + std::to_string(lineNum)));
+            return true;
         }
-
-        cleaned += c;
+        Conditional& block = conditionals.back();
+        emitLine(line, block.parentActive ? LINE_LABEL_ONLY : LINE_SKIPPED, expanded);
+        if (isElse) {
+            block.active = block.parentActive && !block.taken;
+            block.taken = true;
+        } else {
+            conditionals.pop_back();
+        }
+        return true;
+    }
+    if (!active) {
+        emitLine(line, LINE_SKIPPED, expanded);
+        return true;
     }
 
-    std::vector<std::string> expanded;
-    std::vector<std::string> linesToProcess;
-    {
-        std::stringstream ssLines(cleaned);
-        std::string raw;
-        while (std::getline(ssLines, raw)) {
-            linesToProcess.push_back(raw);
+    if (equalsIgnoreCase(second, "MACRO")) {
+        emitLine(line, LINE_SKIPPED, expanded);
+        toUpperInto(first, macroKey);
+        captureDepth = 1;
+        captureLine = lineNum;
+        if (macros.find(std::string_view(macroKey)) != macros.end()) {
+            // The body is still collected, as a block repeated zero times.
+            reportError(lineNum, line, diagnose("E_MACRO", first, "Macro already defined: " + macroKey));
+            captureMacro = nullptr;
+            repeatCount = 0;
+            repeatBody.clear();
+            return true;
         }
-        if (!cleaned.empty() && cleaned.back() == '\n') {
-            linesToProcess.push_back("");
+        captureMacro = &macros[arena.copy(macroKey)];
+        splitFields(trimView(secondRest), ',', captureMacro->parameters);
+        return true;
+    }
+    if (equalsIgnoreCase(first, "REPT")) {
+        emitLine(line, LINE_LABEL_ONLY, expanded);
+        int32_t count = 0;
+        if (!evaluateExpression(operands, count)) {
+            reportError(lineNum, line, diagnose("E_EXPRESSION", operands, "Invalid REPT count at line " +
+                                                std::to_string(lineNum) + ": " + expressionError() +
+                                                unresolvedEquNote(operands)));
+        } else if (count < 0) {
+            reportError(lineNum, line, diagnose("E_VALUE_RANGE", operands, "Negative REPT count at line " + std::to_string(lineNum)));
         }
+        captureDepth = 1;
+        captureLine = lineNum;
+        captureMacro = nullptr;
+        repeatCount = std::max(0, count);
+        repeatBody.clear();
+        return true;
+    }
+    if (equalsIgnoreCase(first, "ENDM") || equalsIgnoreCase(first, "ENDR")) {
+        emitLine(line, LINE_SKIPPED, expanded);
+        reportError(lineNum, line, diagnose("E_MACRO", first, toUpper(std::string(first)) + " without MACRO or REPT at line " +
+                                            std::to_string(lineNum)));
+        return true;
     }
 
-    for (const auto& rawLine : linesToProcess) {
-        std::string parseLine = rawLine;
-        size_t commentPos = parseLine.find("//");
-        if (commentPos != std::string::npos) parseLine = parseLine.substr(0, commentPos);
-        commentPos = parseLine.find(';');
-        if (commentPos != std::string::npos) parseLine = parseLine.substr(0, commentPos);
-        parseLine = trim(parseLine);
-
-        if (parseLine.empty()) {
-            expanded.push_back(rawLine);
-            continue;
+    // Constants are defined as soon as they can be evaluated so REPT counts and IF
+    // conditions can use them; one that refers to a later constant waits in pendingEQUs
+    // like in pass 1. Pass 1 starts again from an empty symbol table.
+    if (equalsIgnoreCase(second, "EQU")) {
+        const std::string_view expression = trimView(secondRest);
+        int32_t value;
+        Symbol& symbol = defineSymbol(first);
+        if (evaluateExpression(expression, value)) {
+            symbol = {first, value, CONSTANT, true};
+            resolvePendingEqus();
+        } else {
+            symbol = {first, 0, CONSTANT, false};
+            pendingEQUs.push_back({&symbol, expression, lineNum});
         }
+        return false;
+    }
 
-        std::stringstream ss(parseLine);
-        std::string mnemonic;
-        ss >> mnemonic;
-        if (toUpper(mnemonic) == "INCLUDE") {
-            expanded.push_back(rawLine);
-
-            std::string includeToken;
-            std::getline(ss, includeToken);
-            std::string includeName = normalizeIncludeName(includeToken);
-            auto it = includeFileContents.find(includeName);
-            if (it == includeFileContents.end()) {
-                error = "Include file not found: " + includeName;
-                return {};
-            }
-
-            if (std::find(includeStack.begin(), includeStack.end(), includeName) != includeStack.end()) {
-                error = "Recursive include detected: " + includeName;
-                return {};
-            }
+    if (macros.empty() || first.empty()) return false;
+    toUpperInto(first, macroKey);
+    auto macro = macros.find(std::string_view(macroKey));
+    if (macro == macros.end()) return false;
+
+    emitLine(line, LINE_LABEL_ONLY, expanded);
+    std::vector<std::string_view> arguments;
+    splitFields(operands, ',', arguments);
+    if (arguments.size() > macro->second.parameters.size()) {
+        reportError(lineNum, line, diagnose("E_MACRO", operands, "Too many arguments for macro " + macroKey +
+                                            " at line " + std::to_string(lineNum)));
+        return true;
+    }
+    const int kMaxExpansionDepth = 64;
+    if (expansionDepth >= kMaxExpansionDepth) {
+        reportError(lineNum, line, diagnose("E_MACRO", first, "Macro expansion too deep at line " +
+                                            std::to_string(lineNum) + " (recursive macro?)"));
+        return true;
+    }
+    ++expansionDepth;
+    replayLines(macro->second.body, &macro->second, arguments, expanded);
+    --expansionDepth;
+    return true;
+}
 
-            includeStack.push_back(includeName);
-            std::vector<std::string> includeLines;
-            {
-                std::stringstream ssInc(it->second);
-                std::string incRaw;
-                while (std::getline(ssInc, incRaw)) {
-                    includeLines.push_back(incRaw);
-                }
-                if (!it->second.empty() && it->second.back() == '\n') {
-                    includeLines.push_back("");
-                }
-            }
-            std::string includeError;
-            std::vector<std::string> nested = preprocessIncludes(includeLines, includeError, includeStack);
-            includeStack.pop_back();
-            if (!includeError.empty()) {
-                error = includeError;
-                return {};
-            }
+// Feeds a macro or REPT body back through the preprocessor. Lines that need no parameter
+// substitution are emitted as views of the body itself, so repeating a block copies nothing.
+void Assembler::replayLines(const std::vector<std::string_view>& body, const MacroDefinition* macro,
+                            const std::vector<std::string_view>& arguments, std::vector<std::string_view>& expanded) {
+    const uint32_t expansion = ++macroExpansions;
+    for (std::string_view bodyLine : body) {
+        pendingMarks = LINE_HAS_ANY;
+        std::string_view line = macro != nullptr ? substituteParameters(bodyLine, *macro, arguments, expansion) : bodyLine;
+        if (preprocessDirective(line, expanded)) continue;
+        emitLine(line, LINE_EXPANDED, expanded);
+        std::string_view operand;
+        if (parseIncludeOperand(line, operand)) {
+            toUpperInto(operand, includeKey);
+            expandInclude(line, expanded);
+        }
+    }
+}
 
-            expanded.insert(expanded.end(), nested.begin(), nested.end());
+// Replaces whole-word parameter names with the call's arguments, and \@ with a number
+// unique to this expansion (for local labels). Quoted text and comments are left alone.
+// Returns `line` itself when nothing was replaced.
+std::string_view Assembler::substituteParameters(std::string_view line, const MacroDefinition& macro,
+                                                 const std::vector<std::string_view>& arguments, uint32_t expansion) {
+    std::string& out = substitutionBuffer;
+    out.clear();
+    bool changed = false;
+    size_t copied = 0;
+    char quote = 0;
+    for (size_t i = 0; i < line.size();) {
+        const char c = line[i];
+        if (quote != 0) {
+            if (c == quote) quote = 0;
+            ++i;
             continue;
         }
+        if (c == '"' || c == '\'') {
+            quote = c;
+            ++i;
+            continue;
+        }
+        if (c == ';' || (c == '/' && i + 1 < line.size() && line[i + 1] == '/')) break;
+        if (c == '\\' && i + 1 < line.size() && line[i + 1] == '@') {
+            out.append(line.substr(copied, i - copied));
+            out += std::to_string(expansion);
+            i += 2;
+            copied = i;
+            changed = true;
+            continue;
+        }
+        // A word preceded by '.' is a size suffix such as the W of LD.W, never a parameter.
+        if (!std::isalpha(static_cast<unsigned char>(c)) && c != '_') { ++i; continue; }
+        if (i > 0 && (isWordChar(line[i - 1]) || line[i - 1] == '.')) { ++i; continue; }
+        size_t end = i + 1;
+        while (end < line.size() && isWordChar(line[end])) ++end;
+        std::string_view word = line.substr(i, end - i);
+        for (size_t p = 0; p < macro.parameters.size(); ++p) {
+            if (!equalsIgnoreCase(word, macro.parameters[p])) continue;
+            out.append(line.substr(copied, i - copied));
+            if (p < arguments.size()) out.append(arguments[p]);
+            copied = end;
+            changed = true;
+            break;
+        }
+        i = end;
+    }
+    if (!changed) return line;
+    out.append(line.substr(copied));
+    return arena.copy(out);
+}
+
+// The part of expanded line `index` that pass 1 and pass 2 assemble.
+std::string_view Assembler::lineText(size_t index) const {
+    switch (lineKinds[index]) {
+    case LINE_LABEL_ONLY: {
+        std::string_view code = stripComment(expandedLines[index]);
+        size_t colonPos = code.find(':');
+        return colonPos == std::string_view::npos ? std::string_view() : code.substr(0, colonPos + 1);
+    }
+    case LINE_SKIPPED:
+        return std::string_view();
+    default:
+        return expandedLines[index];
+    }
+}
 
-        expanded.push_back(rawLine);
+void Assembler::setIncludeGraph(const IncludeGraph& graph) {
+    includeGraph.clear();
+    for (const auto& entry : graph) {
+        includeGraph[toUpper(trim(entry.first))] = entry.second;
     }
+}
 
-    return expanded;
+const std::vector<IncludeDirective>* Assembler::findIncludeDirectives(std::string_view file) const {
+    auto it = includeGraph.find(file);
+    return it == includeGraph.end() ? nullptr : &it->second;
 }
 
 std::string Assembler::assemble(const std::string& sourceCode) {
+    return assembleBuffer(sourceCode);
+}
+
+std::string Assembler::assembleBuffer(std::string_view sourceCode) {
     LOGI("Starting assembly process...");
     symbolTable.clear();
     instructions.clear();
+    expandedLines.clear();
+    expandedMarks.clear();
+    expandedSourceLines.clear();
+    includeStack.clear();
+    pendingEQUs.clear();
+    arena.reset();
     currentAddress = 0;
-    listingOutput = "";
-
-    std::vector<std::string> lines = split(sourceCode, '\n');
-    std::string error;
-    std::vector<std::string> includeStack;
-    std::vector<std::string> expandedLines = preprocessIncludes(lines, error, includeStack);
-    if (!error.empty()) return "ERROR: " + error;
+    listingOutput.clear();
+    stats = AssemblyStats();
+    const uint64_t allocationsAtStart = allocationCount();
+
+    diagnostics.clear();
+    warnings.clear();
+    overlaps.clear();
+    occupancy.clear();
+    writerOf.clear();
+    fileRuns.assign(1, {0, std::string_view()});
+    sourceText = sourceCode;
+
+    // Every phase runs even after an error so one call reports every bad line. The
+    // returned string keeps its old contract: "ERROR: " plus the first diagnostic.
+    Clock::time_point phaseStart = Clock::now();
+    lineKinds.clear();
+    macros.clear();
+    conditionals.clear();
+    captureDepth = 0;
+    captureMacro = nullptr;
+    macroExpansions = 0;
+    expansionDepth = 0;
+    preprocessorActive = hasPreprocessorKeywords(sourceCode);
+    for (const auto& entry : includeFileContents) {
+        if (preprocessorActive) break;
+        preprocessorActive = hasPreprocessorKeywords(entry.second);
+    }
 
-    LOGI("Expanded source has %zu lines", expandedLines.size());
-    if (expandedLines.size() > 5) {
-        LOGI("First 3 expanded lines: '%s', '%s', '%s'", expandedLines[0].c_str(), expandedLines[1].c_str(), expandedLines[2].c_str());
+    scanLines(sourceCode, sourceLines, sourceMarks);
+    for (std::string_view& line : sourceLines) line = trimView(line);
+    preprocessIncludes(sourceLines, sourceMarks, findIncludeDirectives(std::string_view()), expandedLines);
+    if (preprocessorActive) {
+        if (captureDepth > 0) {
+            reportError(captureLine, expandedLines[captureLine - 1],
+                        diagnose("E_MACRO", std::string_view(), "MACRO or REPT at line " + std::to_string(captureLine) + " has no ENDM/ENDR"));
+        }
+        if (!conditionals.empty()) {
+            const int line = conditionals.back().line;
+            reportError(line, expandedLines[line - 1],
+                        diagnose("E_CONDITIONAL", std::string_view(), "IF at line " + std::to_string(line) + " has no ENDIF"));
+        }
+        // Constants defined for REPT and IF; pass 1 defines every symbol again.
+        symbolTable.clear();
+        pendingEQUs.clear();
+    } else {
+        lineKinds.assign(expandedLines.size(), LINE_SOURCE);
     }
+    stats.preprocessMs = elapsedMs(phaseStart);
+    stats.sourceLines = sourceLines.size();
+    stats.expandedLines = expandedLines.size();
+
+    phaseStart = Clock::now();
+    const size_t preprocessDiagnostics = diagnostics.size();
+    lineWidened.assign(expandedLines.size(), 0);
+    pass1(expandedLines);
+    if (relaxBranches || optimize) {
+        // Widening only ever grows the code, so this reaches a fixed point, usually within a
+        // couple of rounds. Each round re-runs pass 1 from scratch so labels and EQUs that
+        // depend on them see the new addresses. Shortened JMPs start out short and are
+        // widened back the same way.
+        while (widenOutOfRangeBranches()) {
+            diagnostics.resize(preprocessDiagnostics);
+            for (auto& entry : symbolTable) entry.second.isDefined = false;
+            pass1(expandedLines);
+            stats.relaxationPasses++;
+        }
+    }
+    stats.pass1Ms = elapsedMs(phaseStart);
+    stats.symbolCount = symbolTable.size();
     
-    if (!pass1(expandedLines, error)) return "ERROR: " + error;
-    LOGI("Pass 1 completed. Symbols defined: %zu", symbolTable.size());
-    
-    if (!pass2(expandedLines, error)) return "ERROR: " + error;
+    phaseStart = Clock::now();
+    pass2(expandedLines);
+    if (objectMode) checkExports(expandedLines);
+    stats.pass2Ms = elapsedMs(phaseStart);
+    if (!diagnostics.empty()) {
+        stats.allocations = allocationCount() - allocationsAtStart;
+        return "ERROR: " + diagnostics.front().message;
+    }
+
+    phaseStart = Clock::now();
+    if (objectMode) hexOutput = buildObject();
+    else writeHex();
+    stats.hexMs = elapsedMs(phaseStart);
+
+    phaseStart = Clock::now();
+    for (size_t i = 0; i < instructions.size(); ++i) generateListingLine(i);
+    stats.listingMs = elapsedMs(phaseStart);
+    stats.allocations = allocationCount() - allocationsAtStart;
 
-    std::vector<std::pair<uint16_t, uint8_t>> image;
-    for (const auto& inst : instructions) {
-        for (size_t i = 0; i < inst.bytes.size(); ++i) {
-            image.push_back({static_cast<uint16_t>(inst.address + i), inst.bytes[i]});
+    LOGI("Assembly finished: %zu lines, %zu symbols, %zu bytes, %llu expressions evaluated",
+         stats.expandedLines, stats.symbolCount, stats.bytesEmitted,
+         static_cast<unsigned long long>(stats.expressionEvaluations));
+    return hexOutput;
+}
+
+void Assembler::writeHex() {
+    // The image is a list of byte runs rather than one entry per byte, so a large DS fill
+    // costs nothing until its HEX records are written.
+    image.clear();
+    occupancy.assign(kMemorySize / 64, 0);
+    stats.bytesEmitted = 0;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        const uint32_t length = instructions.length[i];
+        if (length == 0) continue;
+        const uint16_t address = instructions.address[i];
+        // A fill longer than memory wraps more than once; each pass over it is its own
+        // segment of at most kMemorySize bytes.
+        uint32_t first = 0;
+        uint16_t at = address;
+        while (first < length) {
+            const uint32_t chunk = std::min<uint32_t>(length - first, kMemorySize - at);
+            image.push_back({at, static_cast<uint32_t>(i), first, chunk});
+            markOccupied(at, chunk, static_cast<uint32_t>(i), first);
+            first += chunk;
+            at = 0;
         }
+        stats.bytesEmitted += length;
+    }
+    for (const MemoryOverlap& overlap : overlaps) {
+        std::string range;
+        appendHexWord(range, overlap.address);
+        range += '-';
+        appendHexWord(range, static_cast<uint16_t>(overlap.address + overlap.length - 1));
+        warnings.push_back({overlap.secondLine, 0, "W_OVERLAP",
+                            "Line " + std::to_string(overlap.secondLine) + " overwrites " + std::to_string(overlap.length) +
+                                " byte(s) at " + range + " already written by line " + std::to_string(overlap.firstLine)});
     }
 
-    std::sort(image.begin(), image.end(), [](const auto& a, const auto& b) {
-        return a.first < b.first;
-    });
+    // Ties keep source order; most programs are already in address order.
+    auto segmentOrder = [](const ImageSegment& a, const ImageSegment& b) {
+        if (a.address != b.address) return a.address < b.address;
+        return a.entry != b.entry ? a.entry < b.entry : a.first < b.first;
+    };
+    if (!std::is_sorted(image.begin(), image.end(), segmentOrder)) {
+        std::sort(image.begin(), image.end(), segmentOrder);
+    }
 
-    std::stringstream hexOutput;
-    size_t idx = 0;
-    const size_t recordSize = 0x20;
-    while (idx < image.size()) {
-        uint16_t startAddr = image[idx].first;
-        std::vector<uint8_t> record;
-        record.push_back(image[idx].second);
-        size_t j = idx + 1;
-        while (j < image.size() && record.size() < recordSize && image[j].first == static_cast<uint16_t>(startAddr + record.size())) {
-            record.push_back(image[j].second);
-            ++j;
+    hexOutput.clear();
+    const uint32_t recordSize = 0x20;
+    uint8_t record[recordSize];
+    size_t segment = 0;
+    uint32_t position = 0;
+    while (segment < image.size()) {
+        const uint16_t startAddr = static_cast<uint16_t>(image[segment].address + position);
+        uint32_t count = 0;
+        while (count < recordSize && segment < image.size()) {
+            const ImageSegment& run = image[segment];
+            if (static_cast<uint16_t>(run.address + position) != static_cast<uint16_t>(startAddr + count)) break;
+            const uint32_t take = std::min(recordSize - count, run.length - position);
+            for (uint32_t k = 0; k < take; ++k) {
+                record[count + k] = instructions.byteAt(run.entry, run.first + position + k);
+            }
+            count += take;
+            position += take;
+            if (position == run.length) {
+                ++segment;
+                position = 0;
+            }
         }
 
-        uint8_t count = static_cast<uint8_t>(record.size());
         int checksum = count + (startAddr >> 8) + (startAddr & 0xFF);
-        hexOutput << ":" << std::hex << std::setw(2) << std::setfill('0') << std::uppercase << (int)count
-                  << std::setw(4) << startAddr << "00";
-        for (uint8_t b : record) {
-            hexOutput << std::setw(2) << (int)b;
-            checksum += b;
+        hexOutput += ':';
+        appendHexByte(hexOutput, static_cast<uint8_t>(count));
+        appendHexWord(hexOutput, startAddr);
+        hexOutput += "00";
+        for (uint32_t k = 0; k < count; ++k) {
+            appendHexByte(hexOutput, record[k]);
+            checksum += record[k];
         }
-        hexOutput << std::setw(2) << ((~checksum + 1) & 0xFF) << "\n";
-        idx = j;
+        appendHexByte(hexOutput, static_cast<uint8_t>((~checksum + 1) & 0xFF));
+        hexOutput += '\n';
     }
-    hexOutput << ":00000001FF\n";
+    hexOutput += ":00000001FF\n";
+}
 
-    for (const auto& inst : instructions) generateListingLine(inst);
-    LOGI("Assembly finished successfully.");
-    return hexOutput.str();
+// Sets the occupancy bits of a range that does not wrap and records any byte that an
+// earlier entry, or an earlier pass of a wrapping one, already wrote. Who wrote each
+// address is only tracked after the first overlap, so a program without overlaps pays for
+// nothing but the bitmap. `first` is the offset of the range within the entry's bytes.
+void Assembler::markOccupied(uint16_t address, uint32_t length, uint32_t entry, uint32_t first) {
+    const uint32_t end = std::min<uint32_t>(address + length, kMemorySize);
+    const int secondLine = static_cast<int>(instructions.lineIndex[entry]) + 1;
+    for (uint32_t at = address; at < end;) {
+        const uint32_t bit = at & 63;
+        const uint32_t count = std::min<uint32_t>(64 - bit, end - at);
+        const uint64_t mask = (count == 64 ? ~0ULL : ((1ULL << count) - 1)) << bit;
+        const uint64_t clash = occupancy[at >> 6] & mask;
+        occupancy[at >> 6] |= mask;
+        at += count;
+        if (clash == 0) continue;
+
+        if (writerOf.empty()) buildWriters(entry, first);
+        for (uint32_t b = 0; b < 64; ++b) {
+            if ((clash & (1ULL << b)) == 0) continue;
+            const uint16_t clashAt = static_cast<uint16_t>((at - count - bit) + b);
+            const int firstLine = static_cast<int>(instructions.lineIndex[writerOf[clashAt]]) + 1;
+            if (!overlaps.empty()) {
+                MemoryOverlap& last = overlaps.back();
+                if (last.secondLine == secondLine && last.firstLine == firstLine &&
+                    static_cast<uint32_t>(last.address) + last.length == clashAt) {
+                    last.length++;
+                    continue;
+                }
+            }
+            overlaps.push_back({clashAt, 1, firstLine, secondLine});
+        }
+    }
+    if (!writerOf.empty()) std::fill(writerOf.begin() + address, writerOf.begin() + end, entry);
 }
 
-std::string Assembler::getListing() const { return listingOutput; }
+// Replays the entries before `entry` into writerOf, plus the first `marked` bytes of
+// `entry` itself, which a wrapping fill has already written before the range being marked.
+void Assembler::buildWriters(uint32_t entry, uint32_t marked) {
+    writerOf.assign(kMemorySize, 0);
+    for (uint32_t j = 0; j < entry || (marked > 0 && j == entry); ++j) {
+        const uint32_t length = std::min<uint32_t>(j < entry ? instructions.length[j] : marked, kMemorySize);
+        for (uint32_t k = 0; k < length; ++k) {
+            writerOf[static_cast<uint16_t>(instructions.address[j] + k)] = j;
+        }
+    }
+}
 
-void Assembler::generateListingLine(const Instruction& inst) {
-    std::stringstream ss;
-    ss << std::setw(4) << std::setfill(' ') << std::dec << inst.lineNumber << ": ";
-    if (inst.bytes.empty() && !inst.isDirective) ss << "               ";
-    else if (inst.isDirective && inst.bytes.empty()) ss << std::setw(4) << std::hex << std::setfill('0') << std::uppercase << inst.address << "           ";
-    else {
-        ss << std::setw(4) << std::hex << std::setfill('0') << std::uppercase << inst.address << " ";
-        for(size_t i=0; i<4 && i<inst.bytes.size(); i++) ss << std::setw(2) << std::setfill('0') << (int)inst.bytes[i] << " ";
-        for(size_t i=inst.bytes.size(); i<4; i++) ss << "   ";
+const std::vector<Diagnostic>& Assembler::getWarnings() const { return warnings; }
+
+MemoryMap Assembler::getMemoryMap() const {
+    MemoryMap map;
+    if (occupancy.empty()) return map;
+    auto occupied = [this](uint32_t address) { return (occupancy[address >> 6] >> (address & 63)) & 1; };
+
+    for (uint32_t start = 0; start < kMemorySize;) {
+        const bool used = occupied(start);
+        uint32_t end = start + 1;
+        while (end < kMemorySize && occupied(end) == used) ++end;
+        (used ? map.regions : map.gaps).push_back({static_cast<uint16_t>(start), end - start});
+        if (used) map.usedBytes += end - start;
+        start = end;
+    }
+
+    // A label's extent stops at the next label or at the end of its region, whichever is
+    // first; a label on unused memory (reserved space, an EQU-like address) has none.
+    std::vector<const Symbol*> labels;
+    for (const auto& entry : symbolTable) {
+        if (entry.second.type == LABEL && entry.second.isDefined) labels.push_back(&entry.second);
+    }
+    std::sort(labels.begin(), labels.end(), [](const Symbol* a, const Symbol* b) {
+        return a->value != b->value ? (a->value & 0xFFFF) < (b->value & 0xFFFF) : a->name < b->name;
+    });
+    size_t region = 0;
+    for (size_t i = 0; i < labels.size(); ++i) {
+        const uint32_t start = static_cast<uint32_t>(labels[i]->value) & 0xFFFF;
+        uint32_t limit = kMemorySize;
+        for (size_t next = i + 1; next < labels.size(); ++next) {
+            const uint32_t address = static_cast<uint32_t>(labels[next]->value) & 0xFFFF;
+            if (address > start) {
+                limit = address;
+                break;
+            }
+        }
+        while (region < map.regions.size() && map.regions[region].start + map.regions[region].length <= start) ++region;
+        uint32_t bytes = 0;
+        if (region < map.regions.size() && map.regions[region].start <= start) {
+            bytes = std::min(limit, map.regions[region].start + map.regions[region].length) - start;
+        }
+        map.labels.push_back({std::string(labels[i]->name), static_cast<uint16_t>(start), bytes});
     }
-    ss << "    " << inst.originalLine << "\n";
-    if (inst.bytes.size() > 4) {
-        for(size_t i=4; i<inst.bytes.size(); i+=4) {
-            ss << "          ";
-            for(size_t j=0; j<4 && (i+j)<inst.bytes.size(); j++) ss << std::setw(2) << std::hex << std::setfill('0') << std::uppercase << (int)inst.bytes[i+j] << " ";
-            ss << "\n";
+
+    // Entries are in line order, so the file of each one is found with one sweep.
+    size_t run = 0;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        while (run + 1 < fileRuns.size() && fileRuns[run + 1].first <= instructions.lineIndex[i]) ++run;
+        const uint32_t length = instructions.length[i];
+        if (length == 0) continue;
+        const std::string_view file = fileRuns[run].second;
+        auto usage = std::find_if(map.files.begin(), map.files.end(), [file](const FileUsage& f) { return f.file == file; });
+        if (usage == map.files.end()) {
+            map.files.push_back({std::string(file), 0});
+            usage = map.files.end() - 1;
         }
+        usage->bytes += length;
     }
-    const_cast<Assembler*>(this)->listingOutput += ss.str();
+    map.overlaps = overlaps;
+    return map;
 }
 
-bool Assembler::pass1(const std::vector<std::string>& lines, std::string& error) {
-    LOGI("Starting Pass 1...");
-    currentAddress = 0;
-    int lineNum = 0;
-    std::vector<std::pair<std::string, std::pair<std::string, int>>> pendingEQUs;
+std::string memoryMapToJson(const MemoryMap& map) {
+    std::string out = "{\"used_bytes\":" + std::to_string(map.usedBytes);
+    auto appendRanges = [&out](const char* key, const std::vector<MemoryRange>& ranges) {
+        out += ",\"";
+        out += key;
+        out += "\":[";
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            out += i == 0 ? "{" : ",{";
+            out += "\"start\":" + std::to_string(ranges[i].start) + ",\"length\":" + std::to_string(ranges[i].length) + "}";
+        }
+        out += ']';
+    };
+    appendRanges("regions", map.regions);
+    appendRanges("gaps", map.gaps);
+    out += ",\"labels\":[";
+    for (size_t i = 0; i < map.labels.size(); ++i) {
+        out += i == 0 ? "{\"name\":" : ",{\"name\":";
+        appendJsonString(out, map.labels[i].name);
+        out += ",\"address\":" + std::to_string(map.labels[i].address) + ",\"bytes\":" + std::to_string(map.labels[i].bytes) + "}";
+    }
+    out += "],\"files\":[";
+    for (size_t i = 0; i < map.files.size(); ++i) {
+        out += i == 0 ? "{\"file\":" : ",{\"file\":";
+        appendJsonString(out, map.files[i].file);
+        out += ",\"bytes\":" + std::to_string(map.files[i].bytes) + "}";
+    }
+    out += "],\"overlaps\":[";
+    for (size_t i = 0; i < map.overlaps.size(); ++i) {
+        const MemoryOverlap& overlap = map.overlaps[i];
+        out += i == 0 ? "{" : ",{";
+        out += "\"address\":" + std::to_string(overlap.address) + ",\"length\":" + std::to_string(overlap.length) +
+               ",\"first_line\":" + std::to_string(overlap.firstLine) + ",\"second_line\":" + std::to_string(overlap.secondLine) + "}";
+    }
+    out += "]}";
+    return out;
+}
 
-    for (const auto& rawLine : lines) {
-        lineNum++;
-        if (lineNum % 200 == 0) LOGI("Pass 1: Processed %d lines...", lineNum);
-        
-        std::string line = rawLine;
+std::string Assembler::getListing() const { return listingOutput; }
 
-        size_t commentPos = line.find("//");
-        if (commentPos != std::string::npos) line = line.substr(0, commentPos);
-        commentPos = line.find(';');
-        if (commentPos != std::string::npos) line = line.substr(0, commentPos);
-        line = trim(line);
+const std::vector<Diagnostic>& Assembler::getDiagnostics() const { return diagnostics; }
+
+std::string diagnosticsToJson(const std::vector<Diagnostic>& diagnostics) {
+    std::string out = "[";
+    for (size_t i = 0; i < diagnostics.size(); ++i) {
+        const Diagnostic& d = diagnostics[i];
+        if (i > 0) out += ',';
+        out += "{\"line\":" + std::to_string(d.line) + ",\"column\":" + std::to_string(d.column) +
+               ",\"code\":\"" + d.code + "\",\"message\":";
+        appendJsonString(out, d.message);
+        out += '}';
+    }
+    out += ']';
+    return out;
+}
 
-        if (line.empty()) continue;
+std::string Assembler::diagnose(const char* code, std::string_view token, std::string message) {
+    errorCode = code;
+    errorToken = token;
+    return message;
+}
 
-        std::stringstream ssEqu(line);
-        std::string label, equMnemonic;
-        ssEqu >> label >> equMnemonic;
-        if (toUpper(equMnemonic) == "EQU") {
-            std::string valStr; std::getline(ssEqu, valStr);
-            valStr = trim(valStr);
-            int32_t val;
-            if (evaluateExpression(valStr, val)) {
-                symbolTable[toUpper(label)] = {label, val, CONSTANT, true};
-            } else {
-                // Defer resolution
-                symbolTable[toUpper(label)] = {label, 0, CONSTANT, false}; // Mark as undefined for now
-                pendingEQUs.push_back({toUpper(label), {valStr, lineNum}});
+void Assembler::reportError(int lineNumber, std::string_view lineText, const std::string& message) {
+    // The column is only known when the offending text is a view into this line; text that
+    // was rewritten (upper-cased mnemonics, stripped comments) leaves it at 0.
+    int column = 0;
+    if (!errorToken.empty() && errorToken.data() >= lineText.data() &&
+        errorToken.data() <= lineText.data() + lineText.size()) {
+        column = static_cast<int>(errorToken.data() - lineText.data()) + 1;
+        // Main-source lines are trimmed when split; count the indentation they lost.
+        const char* start = lineText.data();
+        if (start > sourceText.data() && start <= sourceText.data() + sourceText.size()) {
+            while (start > sourceText.data() && (start[-1] == ' ' || start[-1] == '\t')) {
+                --start;
+                ++column;
             }
-            continue;
         }
+    }
+    diagnostics.push_back({lineNumber, column, errorCode, message});
+    errorCode = "";
+    errorToken = std::string_view();
+}
 
-        std::string labelName;
-        std::string upperLabel;
-        size_t colonPos = line.find(':');
-        if (colonPos != std::string::npos) {
-            labelName = trim(line.substr(0, colonPos));
-            if (!labelName.empty()) {
-                upperLabel = toUpper(labelName);
-                LOGI("Pass 1: Found label '%s' (normalized: '%s') at address %04X", labelName.c_str(), upperLabel.c_str(), currentAddress);
-                symbolTable[upperLabel] = {labelName, (int32_t)currentAddress, LABEL, true};
+std::string Assembler::getSymbols() const {
+    std::string out;
+    char value[16];
+    for (const auto& entry : symbolTable) {
+        const Symbol& sym = entry.second;
+        int length = std::snprintf(value, sizeof(value), "%04X", static_cast<unsigned int>(sym.value));
+        out.append(entry.first);
+        out += '\t';
+        out.append(value, static_cast<size_t>(length));
+        out += '\t';
+        out += (sym.type == LABEL) ? "LABEL" : (sym.type == EXTERNAL) ? "EXTERN" : "EQU";
+        out += '\n';
+    }
+    return out;
+}
+
+const AssemblyStats& Assembler::getStats() const { return stats; }
+
+void Assembler::setBranchRelaxation(bool enabled) { relaxBranches = enabled; }
+
+bool Assembler::isCode(size_t entry) const {
+    const uint8_t notCode = InstructionTable::DIRECTIVE | InstructionTable::FAILED | InstructionTable::FILL | InstructionTable::DATA;
+    return instructions.length[entry] > 0 && (instructions.flags[entry] & notCode) == 0;
+}
+
+uint32_t Assembler::entryCycles(size_t entry) const {
+    const uint32_t length = instructions.length[entry];
+    const uint8_t opcode = instructions.byteAt(entry, 0);
+    // A widened branch is the inverted short branch followed by a JMP.
+    if (length == 5 && (opcode & 0xF0) == 0xE0) return estimateCycles(opcode, 2) + estimateCycles(0xF3, 3);
+    return estimateCycles(opcode, length);
+}
+
+// A region runs from a line with a label to the next one. Its worst case follows every
+// branch that stays inside it; one that leaves it (or a return) ends the path there.
+std::vector<CycleRegion> Assembler::getCycleRegions() const {
+    std::vector<CycleRegion> regions;
+    if (occupancy.empty()) return regions;
+
+    std::vector<size_t> starts;
+    size_t run = 0;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        const uint32_t lineIndex = instructions.lineIndex[i];
+        while (run + 1 < fileRuns.size() && fileRuns[run + 1].first <= lineIndex) ++run;
+        const uint8_t marks = expandedMarks[lineIndex];
+        std::string_view line = stripComment(lineText(lineIndex), marks);
+        const size_t colonPos = findColon(line, marks);
+        if (colonPos == std::string_view::npos) continue;
+        const std::string_view label = trimView(line.substr(0, colonPos));
+        if (label.empty()) continue;
+        starts.push_back(i);
+        regions.push_back({std::string(label), instructions.address[i], static_cast<int>(expandedSourceLines[lineIndex]),
+                           static_cast<int>(lineIndex) + 1, std::string(fileRuns[run].second), 0, 0, 0});
+    }
+    starts.push_back(instructions.size());
+
+    std::vector<size_t> code;
+    std::vector<std::pair<uint16_t, size_t>> byAddress;
+    std::vector<int64_t> worst;
+    size_t kept = 0;
+    for (size_t r = 0; r + 1 < starts.size(); ++r) {
+        CycleRegion region = std::move(regions[r]);
+        code.clear();
+        for (size_t i = starts[r]; i < starts[r + 1]; ++i) {
+            if (instructions.length[i] == 0) continue;
+            // Execution that runs into data leaves the region's code.
+            if (!isCode(i)) break;
+            code.push_back(i);
+        }
+        if (code.empty()) continue;
+
+        byAddress.clear();
+        for (size_t k = 0; k < code.size(); ++k) byAddress.push_back({instructions.address[code[k]], k});
+        std::sort(byAddress.begin(), byAddress.end());
+        auto find = [&byAddress](uint32_t address) -> long {
+            auto it = std::lower_bound(byAddress.begin(), byAddress.end(), std::make_pair(static_cast<uint16_t>(address), size_t(0)));
+            return it != byAddress.end() && it->first == static_cast<uint16_t>(address) ? static_cast<long>(it->second) : -1;
+        };
+        for (size_t entry : code) region.straightCycles += entryCycles(entry);
+        region.instructions = static_cast<uint32_t>(code.size());
+
+        bool loops = false;
+        worst.assign(code.size() + 1, 0);
+        for (size_t k = code.size(); k-- > 0;) {
+            const size_t entry = code[k];
+            const uint8_t opcode = instructions.byteAt(entry, 0);
+            const uint32_t length = instructions.length[entry];
+            const uint16_t next = static_cast<uint16_t>(instructions.address[entry] + length);
+            bool fallsThrough = true;
+            long target = -1;
+            if ((opcode & 0xF0) == 0xE0 && length == 2) {
+                const int8_t offset = static_cast<int8_t>(instructions.byteAt(entry, 1));
+                target = find(static_cast<uint32_t>(next + offset));
+                fallsThrough = opcode != 0xE0;
+            } else if ((opcode & 0xF0) == 0xE0 && length == 5) {
+                target = find(instructions.byteAt(entry, 3) | (instructions.byteAt(entry, 4) << 8));
+            } else if (opcode == 0xF3 && length == 3) {
+                target = find(instructions.byteAt(entry, 1) | (instructions.byteAt(entry, 2) << 8));
+                fallsThrough = false;
+            } else if (opcode == 0xF2 || opcode == 0xC6 || opcode == 0xC7) {
+                fallsThrough = false;
             }
-            line = trim(line.substr(colonPos + 1));
+            if (target >= 0 && static_cast<size_t>(target) <= k) loops = true;
+            int64_t longest = 0;
+            if (fallsThrough && k + 1 < code.size() && instructions.address[code[k + 1]] == next) longest = worst[k + 1];
+            if (target > static_cast<long>(k)) longest = std::max(longest, worst[target]);
+            worst[k] = entryCycles(entry) + longest;
         }
-        if (line.empty()) continue;
+        region.worstCycles = loops ? -1 : worst[0];
+        regions[kept++] = std::move(region);
+    }
+    regions.resize(kept);
+    return regions;
+}
 
-        std::stringstream ss(line);
-        std::string mnemonic; ss >> mnemonic; mnemonic = toUpper(mnemonic);
-        
-        // Handle .WT suffix for shifts
-        if (mnemonic.size() > 3 && mnemonic.substr(mnemonic.size()-3) == ".WT") {
-            mnemonic = mnemonic.substr(0, mnemonic.size()-3);
-        }
+std::string cycleRegionsToJson(const std::vector<CycleRegion>& regions) {
+    std::string out = "{\"model\":\"estimate\",\"regions\":[";
+    for (size_t i = 0; i < regions.size(); ++i) {
+        const CycleRegion& region = regions[i];
+        out += i == 0 ? "{\"label\":" : ",{\"label\":";
+        appendJsonString(out, region.label);
+        out += ",\"address\":" + std::to_string(region.address) + ",\"line\":" + std::to_string(region.line) +
+               ",\"listing_line\":" + std::to_string(region.listingLine) + ",\"file\":";
+        appendJsonString(out, region.file);
+        out += ",\"instructions\":" + std::to_string(region.instructions) +
+               ",\"straight_cycles\":" + std::to_string(region.straightCycles) + ",\"worst_cycles\":" +
+               (region.worstCycles < 0 ? std::string("null") : std::to_string(region.worstCycles)) + "}";
+    }
+    out += "]}";
+    return out;
+}
 
-        if (mnemonic.empty()) continue;
-        int size = 1;
-        if (mnemonic == "INCLUDE") {
-            continue;
-        } else if (mnemonic == "ORG") {
-            std::string valStr; std::getline(ss, valStr);
-            int32_t val;
-            if (!evaluateExpression(valStr, val)) {
-                error = "Invalid ORG expression at line " + std::to_string(lineNum) + ": " + expressionError;
-                return false;
-            }
-            currentAddress = (uint16_t)val;
-            if (!upperLabel.empty()) {
-                symbolTable[upperLabel] = {labelName, (int32_t)currentAddress, LABEL, true};
-            }
-            continue;
-        } else if (mnemonic == "DB") {
-            std::string args; std::getline(ss, args);
-            std::vector<std::string> vals = split(args, ',');
-            size = std::max(1, (int)vals.size());
-        } else if (mnemonic == "DW") {
-            std::string args; std::getline(ss, args);
-            std::vector<std::string> vals = split(args, ',');
-            size = std::max(1, (int)vals.size()) * 2;
-        } else if (mnemonic == "DL") {
-            std::string args; std::getline(ss, args);
-            std::vector<std::string> vals = split(args, ',');
-            size = std::max(1, (int)vals.size()) * 4;
-        } else if (mnemonic == "DM") {
-            std::string args; std::getline(ss, args);
-            std::string t = trim(args);
-            if (t.size() >= 2 && ((t.front() == '"' && t.back() == '"') || (t.front() == '\'' && t.back() == '\''))) {
-                size = std::max(1, (int)t.substr(1, t.size() - 2).size() + 1);
-            } else {
-                size = 1;
-            }
-        } else if (mnemonic == "DS") {
-            std::string args; std::getline(ss, args);
-            std::vector<std::string> vals = split(args, ',');
-            int32_t count = 1;
-            if (!vals.empty() && !trim(vals[0]).empty()) {
-                if (!evaluateExpression(vals[0], count)) {
-                    error = "Invalid DS count at line " + std::to_string(lineNum) + ": " + expressionError;
-                    return false;
-                }
-            }
-            if (count < 0) {
-                error = "Negative DS count at line " + std::to_string(lineNum);
-                return false;
-            }
-            size = static_cast<int>(count);
-        } else if (mnemonic.length() == 3 && mnemonic[0] == 'B') {
-            size = 2;
-        } else if (mnemonic == "JMP" || mnemonic == "JSR") {
-            std::string rest; std::getline(ss, rest);
-            size = (rest.find('(') != std::string::npos) ? 1 : 3;
-        } else if (mnemonic == "LSR" || mnemonic == "LSL" || mnemonic == "ASL" || mnemonic == "ASR" ||
-                   mnemonic == "ROL" || mnemonic == "ROR" || mnemonic == "ROXL" || mnemonic == "ROXR" ||
-                   mnemonic == "BTST" || mnemonic == "BCHG" || mnemonic == "BCLR" || mnemonic == "BSET" ||
-                   mnemonic == "ANDI" || mnemonic == "ORI" || mnemonic == "ADDI") {
-            size = 2;
-        } else if (mnemonic.rfind("LD.", 0) == 0 || mnemonic.rfind("ST.", 0) == 0) {
-            std::string rest; std::getline(ss, rest);
-            std::vector<std::string> opList = split(rest, ',');
-            std::string addrOp = trim((mnemonic[0] == 'L') ? (opList.size() > 1 ? opList[1] : "") : (opList.size() > 0 ? opList[0] : ""));
+void Assembler::setCycleAnnotation(bool enabled) { annotateCycles = enabled; }
+
+std::vector<LineMapEntry> Assembler::getLineMap() const {
+    std::vector<LineMapEntry> entries;
+    if (occupancy.empty()) return entries;
+    size_t run = 0;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        while (run + 1 < fileRuns.size() && fileRuns[run + 1].first <= instructions.lineIndex[i]) ++run;
+        if (instructions.length[i] == 0 || (instructions.flags[i] & (InstructionTable::DIRECTIVE | InstructionTable::FAILED))) continue;
+        const uint32_t lineIndex = instructions.lineIndex[i];
+        entries.push_back({instructions.address[i], instructions.length[i], static_cast<int>(expandedSourceLines[lineIndex]),
+                           static_cast<int>(lineIndex) + 1, fileRuns[run].second, isCode(i)});
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const LineMapEntry& a, const LineMapEntry& b) { return a.address < b.address; });
+    return entries;
+}
+
+std::string lineMapToJson(const std::vector<LineMapEntry>& entries) {
+    std::string out = "{\"lines\":[";
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const LineMapEntry& entry = entries[i];
+        out += i == 0 ? "{" : ",{";
+        out += "\"address\":" + std::to_string(entry.address) + ",\"length\":" + std::to_string(entry.length) +
+               ",\"line\":" + std::to_string(entry.line) + ",\"listing_line\":" + std::to_string(entry.listingLine) +
+               ",\"file\":";
+        appendJsonString(out, entry.file);
+        out += entry.code ? ",\"code\":true}" : ",\"code\":false}";
+    }
+    out += "]}";
+    return out;
+}
+
+void Assembler::setPeepholeOptimization(bool enabled) { optimize = enabled; }
+
+void Assembler::setObjectOutput(bool enabled) { objectMode = enabled; }
+
+void Assembler::setParallelism(unsigned threads) { parallelism = threads; }
 
-            bool wrapped = !addrOp.empty() && addrOp.front() == '(' && addrOp.find(')') != std::string::npos;
-            std::string inside = wrapped ? addrOp.substr(1, addrOp.find(')') - 1) : "";
-            std::string insideUpper = toUpper(trim(inside));
+void Assembler::setAllocationCounter(AllocationCounter counter) { gAllocationCounter = counter; }
 
-            if (wrapped && insideUpper.find("SP") != std::string::npos && inside.find('+') != std::string::npos) size = 2;
-            else if (wrapped && inside.find("++") != std::string::npos) size = 1;
-            else if (wrapped) size = 1;
-            else if (!addrOp.empty() && addrOp[0] == '#') size = (mnemonic[3] == 'B' ? 2 : 3);
-            else size = 3;
+std::string statsToJson(const AssemblyStats& stats) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3)
+       << "{\"preprocess_ms\":" << stats.preprocessMs
+       << ",\"pass1_ms\":" << stats.pass1Ms
+       << ",\"pass2_ms\":" << stats.pass2Ms
+       << ",\"hex_ms\":" << stats.hexMs
+       << ",\"listing_ms\":" << stats.listingMs
+       << ",\"source_lines\":" << stats.sourceLines
+       << ",\"expanded_lines\":" << stats.expandedLines
+       << ",\"includes_expanded\":" << stats.includesExpanded
+       << ",\"symbols\":" << stats.symbolCount
+       << ",\"bytes_emitted\":" << stats.bytesEmitted
+       << ",\"expression_evaluations\":" << stats.expressionEvaluations
+       << ",\"allocations\":" << stats.allocations
+       << ",\"branches_relaxed\":" << stats.branchesRelaxed
+       << ",\"relaxation_passes\":" << stats.relaxationPasses
+       << ",\"peephole_rewrites\":" << stats.peepholeRewrites
+       << ",\"peephole_bytes_saved\":" << stats.peepholeBytesSaved
+       << ",\"peephole_cycles_saved\":" << stats.peepholeCyclesSaved << "}";
+    return ss.str();
+}
+
+void Assembler::generateListingLine(size_t index) {
+    std::string& out = listingOutput;
+    const uint16_t address = instructions.address[index];
+    const uint32_t byteCount = instructions.length[index];
+    const bool isDirective = (instructions.flags[index] & InstructionTable::DIRECTIVE) != 0;
+    const uint32_t lineIndex = instructions.lineIndex[index];
+
+    char number[16];
+    int length = std::snprintf(number, sizeof(number), "%4d: ", static_cast<int>(lineIndex + 1));
+    out.append(number, static_cast<size_t>(length));
+    if (byteCount == 0 && !isDirective) out += "               ";
+    else if (isDirective && byteCount == 0) {
+        appendHexWord(out, address);
+        out += "           ";
+    } else {
+        appendHexWord(out, address);
+        out += ' ';
+        for (uint32_t i = 0; i < 4 && i < byteCount; i++) { appendHexByte(out, instructions.byteAt(index, i)); out += ' '; }
+        for (uint32_t i = byteCount; i < 4; i++) out += "   ";
+    }
+    if (annotateCycles) {
+        if (isCode(index)) {
+            length = std::snprintf(number, sizeof(number), "%4u", entryCycles(index));
+            out.append(number, static_cast<size_t>(length));
+        } else {
+            out += "    ";
+        }
+    }
+    // Lines produced by a macro or REPT expansion are marked so they read as belonging to
+    // the call above them.
+    out += lineKinds[lineIndex] == LINE_EXPANDED ? "  + " : "    ";
+    out.append(expandedLines[lineIndex]);
+    out += '\n';
+    if (byteCount > 4) {
+        for (uint32_t i = 4; i < byteCount; i += 4) {
+            out += "          ";
+            for (uint32_t j = 0; j < 4 && (i + j) < byteCount; j++) { appendHexByte(out, instructions.byteAt(index, i + j)); out += ' '; }
+            out += '\n';
+        }
+    }
+}
+
+void Assembler::pass1(const std::vector<std::string_view>& lines) {
+    currentAddress = 0;
+    pendingEQUs.clear();
+    lineSizes.assign(lines.size(), 0);
+    lineFailed.assign(lines.size(), 0);
+    lineRewrite.assign(lines.size(), REWRITE_NONE);
+    branchSites.clear();
+    relocationBases.clear();
+    exports.clear();
+    if (objectMode) {
+        relocationBases.push_back({std::string_view(), false, 0, 0});
+        relocationBases.push_back({"CODE", false, 0, 0});
+    }
+    resetSections();
+
+    std::string error;
+    lineAddresses.resize(lines.size());
+    const bool presized = presizeParallel(lines);
+    for (size_t index = 0; index < lines.size(); ++index) {
+        const int lineNum = static_cast<int>(index) + 1;
+        lineAddresses[index] = currentAddress;
+        if (presized && linePresized[index]) {
+            const std::string_view label = lineLabels[index];
+            if (!label.empty()) defineSymbol(label) = {label, (int32_t)currentAddress, LABEL, true, currentSection};
+            currentAddress += lineSizes[index];
+            continue;
+        }
+        if (!pass1Line(lineText(index), lineNum, error)) {
+            // Keep going so later lines are still checked; the line takes no space.
+            lineFailed[index] = 1;
+            reportError(lineNum, lines[index], error);
         }
-        currentAddress += size;
     }
     
-    // Attempt to resolve pending EQUs
+    resolvePendingEqus();
+    for (const PendingEqu& pending : pendingEQUs) {
+        error = diagnose("E_UNRESOLVED_EQU", pending.expression,
+                         "Invalid EQU expression at line " + std::to_string(pending.lineNumber) + " (Unresolved forward reference?)");
+        reportError(pending.lineNumber, lines[pending.lineNumber - 1], error);
+    }
+}
+
+// Evaluates deferred EQUs until a round defines nothing new; what is left in pendingEQUs
+// depends on something still undefined.
+void Assembler::resolvePendingEqus() {
     bool progress = true;
     while (progress && !pendingEQUs.empty()) {
         progress = false;
-        for (auto it = pendingEQUs.begin(); it != pendingEQUs.end(); ) {
+        size_t unresolved = 0;
+        for (size_t i = 0; i < pendingEQUs.size(); ++i) {
             int32_t val;
-            if (evaluateExpression(it->second.first, val)) {
-                Symbol& sym = symbolTable[it->first];
-                sym.value = val;
-                sym.isDefined = true;
-                it = pendingEQUs.erase(it);
+            if (evaluateExpression(pendingEQUs[i].expression, val)) {
+                pendingEQUs[i].symbol->value = val;
+                pendingEQUs[i].symbol->base = expressionBase;
+                pendingEQUs[i].symbol->isDefined = true;
                 progress = true;
             } else {
-                ++it;
+                pendingEQUs[unresolved++] = pendingEQUs[i];
             }
         }
+        pendingEQUs.resize(unresolved);
     }
-    if (!pendingEQUs.empty()) {
-        error = "Undefined Symbol: " + pendingEQUs.front().second.first + " at line " + std::to_string(pendingEQUs.front().second.second);
-        // We report the expression mostly, but ideally the missing symbol is inside evaluation
-        // Let's just default to the original error message style
-         error = "Invalid EQU expression at line " + std::to_string(pendingEQUs.front().second.second) + " (Unresolved forward reference?)";
-        return false;
+}
+
+// Names the first deferred EQU that `expression` uses, for REPT and IF errors: such a
+// constant depends on a label or on something defined later, which the preprocessor
+// cannot know yet.
+std::string Assembler::unresolvedEquNote(std::string_view expression) const {
+    for (const PendingEqu& pending : pendingEQUs) {
+        std::string_view rest = expression;
+        for (size_t pos; (pos = findIgnoreCase(rest, pending.symbol->name)) != std::string_view::npos;) {
+            const size_t end = pos + pending.symbol->name.size();
+            const bool wordStart = pos == 0 || !isWordChar(rest[pos - 1]);
+            const bool wordEnd = end == rest.size() || !isWordChar(rest[end]);
+            if (wordStart && wordEnd) {
+                return " (needs a constant known at preprocessing time; EQU " + std::string(pending.symbol->name) +
+                       " at line " + std::to_string(pending.lineNumber) + " could not be resolved)";
+            }
+            rest.remove_prefix(end);
+        }
+    }
+    return std::string();
+}
+
+// Defines the line's label or EQU and sizes it. Returns false with `error` set if the
+// line is invalid.
+bool Assembler::pass1Line(std::string_view rawLine, int lineNum, std::string& error) {
+    const uint8_t marks = expandedMarks[lineNum - 1];
+    std::string_view line = stripComment(rawLine, marks);
+
+    if (line.empty()) return true;
+
+    std::string_view equRest = line;
+    std::string_view label = nextToken(equRest);
+    std::string_view equMnemonic = nextToken(equRest);
+    if (equalsIgnoreCase(equMnemonic, "EQU")) {
+        std::string_view valStr = trimView(equRest);
+        int32_t val;
+        if (evaluateExpression(valStr, val)) {
+            defineSymbol(label) = {label, val, CONSTANT, true, expressionBase};
+        } else {
+            // Defer resolution
+            Symbol& sym = defineSymbol(label);
+            sym = {label, 0, CONSTANT, false}; // Mark as undefined for now
+            pendingEQUs.push_back({&sym, valStr, lineNum});
+        }
+        return true;
     }
 
-    LOGI("Finished Pass 1.");
+    std::string_view labelName;
+    Symbol* labelSymbol = nullptr;
+    size_t colonPos = findColon(line, marks);
+    if (colonPos != std::string_view::npos) {
+        labelName = trimView(line.substr(0, colonPos));
+        if (!labelName.empty()) {
+            labelSymbol = &defineSymbol(labelName);
+            *labelSymbol = {labelName, (int32_t)currentAddress, LABEL, true, currentSection};
+        }
+        line = trimView(line.substr(colonPos + 1));
+    }
+    if (line.empty()) return true;
+
+    std::string_view rest = line;
+    toUpperInto(nextToken(rest), mnemonicBuffer);
+    std::string_view mnemonic = mnemonicBuffer;
+    
+    // Handle .WT suffix for shifts
+    if (mnemonic.size() > 3 && mnemonic.substr(mnemonic.size()-3) == ".WT") {
+        mnemonic.remove_suffix(3);
+    }
+
+    if (mnemonic.empty()) return true;
+    int size = 1;
+    if (mnemonic == "INCLUDE") {
+        return true;
+    } else if (mnemonic == "SECTION" || mnemonic == "GLOBAL" || mnemonic == "EXTERN") {
+        // Only an object has sections and imports; a flat assembly takes no notice of them.
+        if (!objectMode) return true;
+        if (trimView(rest).empty()) {
+            error = diagnose("E_OPERAND", mnemonicBuffer, std::string(mnemonic) + " needs a name at line " + std::to_string(lineNum));
+            return false;
+        }
+        if (mnemonic == "SECTION") {
+            switchSection(nextToken(rest));
+            if (labelSymbol != nullptr) {
+                *labelSymbol = {labelName, (int32_t)currentAddress, LABEL, true, currentSection};
+            }
+        } else if (mnemonic == "GLOBAL") {
+            splitFields(rest, ',', fields);
+            for (std::string_view name : fields) exports.push_back({name, lineNum});
+        } else {
+            declareExterns(rest);
+        }
+        return true;
+    } else if (mnemonic == "ORG") {
+        if (objectMode) {
+            error = diagnose("E_RELOCATION", mnemonicBuffer, "ORG is not allowed in an object at line " + std::to_string(lineNum) + "; place sections with the linker");
+            return false;
+        }
+        int32_t val;
+        if (!evaluateExpression(rest, val)) {
+            error = diagnose("E_EXPRESSION", rest, "Invalid ORG expression at line " + std::to_string(lineNum) + ": " + expressionError());
+            return false;
+        }
+        currentAddress = (uint16_t)val;
+        if (labelSymbol != nullptr) {
+            *labelSymbol = {labelName, (int32_t)currentAddress, LABEL, true};
+        }
+        return true;
+    } else if (mnemonic == "DS") {
+        splitFields(rest, ',', fields);
+        int32_t count = 1;
+        if (!fields.empty() && !fields[0].empty()) {
+            if (!evaluateExpression(fields[0], count)) {
+                error = diagnose("E_EXPRESSION", fields[0], "Invalid DS count at line " + std::to_string(lineNum) + ": " + expressionError());
+                return false;
+            }
+        }
+        if (count < 0) {
+            error = diagnose("E_VALUE_RANGE", rest, "Negative DS count at line " + std::to_string(lineNum));
+            return false;
+        }
+        size = static_cast<int>(count);
+    } else {
+        size = textSize(mnemonic, rest);
+        int32_t value;
+        if (mnemonic.length() == 3 && mnemonic[0] == 'B') {
+            auto opcode = opcodeMap.find(mnemonic);
+            if (relaxBranches && opcode != opcodeMap.end() && (opcode->second & 0xF0) == 0xE0) {
+                if (lineWidened[lineNum - 1]) {
+                    size = (opcode->second == 0xE0) ? 3 : 5;
+                } else {
+                    splitFields(rest, ',', fields);
+                    branchSites.push_back({static_cast<uint32_t>(lineNum - 1), currentAddress,
+                                           fields.empty() ? std::string_view() : fields[0], false, currentSection});
+                }
+            }
+        } else if (optimize && size == 3 && mnemonic == "JMP" && !lineWidened[lineNum - 1]) {
+            lineRewrite[lineNum - 1] = REWRITE_SHORT_JUMP;
+            branchSites.push_back({static_cast<uint32_t>(lineNum - 1), currentAddress, trimView(rest), true, currentSection});
+            size = 2;
+        } else if (optimize && size == 3 && mnemonic == "LD.W" && fields.size() > 1 && !fields[1].empty() &&
+                   fields[1][0] == '#') {
+            // textSize() left the operands in `fields`.
+            const int reg = parseRegister(fields[0]);
+            if (reg >= 0 && reg <= 3 && evaluateExpression(fields[1].substr(1), value) && value == 0 &&
+                expressionBase == 0 && flagsDeadAfter(lineNum - 1)) {
+                lineRewrite[lineNum - 1] = REWRITE_LOAD_ZERO;
+                size = 1;
+            }
+        }
+    }
+    lineSizes[lineNum - 1] = static_cast<uint32_t>(size);
+    currentAddress += size;
     return true;
 }
 
-bool Assembler::pass2(const std::vector<std::string>& lines, std::string& error) {
-    LOGI("Starting Pass 2...");
-    currentAddress = 0;
-    int lineNum = 0;
-    for (const auto& rawLine : lines) {
-        lineNum++;
-        std::string line = rawLine;
-        size_t commentPos = line.find("//");
-        if (commentPos != std::string::npos) line = line.substr(0, commentPos);
-        commentPos = line.find(';');
-        if (commentPos != std::string::npos) line = line.substr(0, commentPos);
-        line = trim(line);
-
-        Instruction inst; inst.lineNumber = lineNum; inst.originalLine = rawLine;
-        inst.isDirective = false; inst.address = currentAddress;
-        if (line.empty()) { instructions.push_back(inst); continue; }
-
-        std::stringstream ssEqu(line);
-        std::string label, equMnemonic;
-        ssEqu >> label >> equMnemonic;
-        if (toUpper(equMnemonic) == "EQU") {
-            inst.isDirective = true;
-            auto it = symbolTable.find(toUpper(label));
-            inst.address = (it == symbolTable.end()) ? currentAddress : static_cast<uint16_t>(it->second.value);
-            instructions.push_back(inst);
+// Size of an instruction or data directive that follows from its text alone, which is
+// every mnemonic but ORG, DS, INCLUDE and SECTION/GLOBAL/EXTERN, before any widening or
+// rewrite. Operands split on the way stay in `fields`.
+int Assembler::textSize(std::string_view mnemonic, std::string_view rest) {
+    if (mnemonic == "DB") return std::max(1, (int)splitFields(rest, ',', fields));
+    if (mnemonic == "DW") return std::max(1, (int)splitFields(rest, ',', fields)) * 2;
+    if (mnemonic == "DL") return std::max(1, (int)splitFields(rest, ',', fields)) * 4;
+    if (mnemonic == "DM") {
+        std::string_view t = trimView(rest);
+        return isQuoted(t) ? std::max(1, (int)(t.size() - 2) + 1) : 1;
+    }
+    if (mnemonic.length() == 3 && mnemonic[0] == 'B') return 2;
+    if (mnemonic == "JMP" || mnemonic == "JSR") return (rest.find('(') != std::string_view::npos) ? 1 : 3;
+    if (mnemonic == "LSR" || mnemonic == "LSL" || mnemonic == "ASL" || mnemonic == "ASR" ||
+        mnemonic == "ROL" || mnemonic == "ROR" || mnemonic == "ROXL" || mnemonic == "ROXR" ||
+        mnemonic == "BTST" || mnemonic == "BCHG" || mnemonic == "BCLR" || mnemonic == "BSET" ||
+        mnemonic == "ANDI" || mnemonic == "ORI" || mnemonic == "ADDI") {
+        return 2;
+    }
+    if (mnemonic.rfind("LD.", 0) == 0 || mnemonic.rfind("ST.", 0) == 0) {
+        size_t count = splitFields(rest, ',', fields);
+        std::string_view addrOp = (mnemonic[0] == 'L') ? (count > 1 ? fields[1] : std::string_view()) : (count > 0 ? fields[0] : std::string_view());
+
+        size_t closePos = addrOp.find(')');
+        bool wrapped = !addrOp.empty() && addrOp.front() == '(' && closePos != std::string_view::npos;
+        std::string_view inside = wrapped ? addrOp.substr(1, closePos - 1) : std::string_view();
+
+        if (wrapped && findIgnoreCase(inside, "SP") != std::string_view::npos && inside.find('+') != std::string_view::npos) return 2;
+        if (wrapped) return 1;
+        if (!addrOp.empty() && addrOp[0] == '#') return (mnemonic.size() > 3 && mnemonic[3] == 'B' ? 2 : 3);
+        return 3;
+    }
+    return 1;
+}
+
+// The part of pass 1 that needs no earlier line: the "name:" label of line `index` and,
+// when the text alone fixes it, its size. Returns false for lines pass1Line() must handle
+// in order: EQU, ORG, DS, object sections and whatever the relaxer or optimizer may resize.
+bool Assembler::presizeLine(size_t index, std::string_view& label, uint32_t& size) {
+    const uint8_t marks = owner->expandedMarks[index];
+    std::string_view line = stripComment(owner->lineText(index), marks);
+    label = std::string_view();
+    size = 0;
+    if (line.empty()) return true;
+
+    std::string_view equRest = line;
+    nextToken(equRest);
+    if (equalsIgnoreCase(nextToken(equRest), "EQU")) return false;
+
+    size_t colonPos = findColon(line, marks);
+    if (colonPos != std::string_view::npos) {
+        label = trimView(line.substr(0, colonPos));
+        line = trimView(line.substr(colonPos + 1));
+    }
+    if (line.empty()) return true;
+
+    std::string_view rest = line;
+    toUpperInto(nextToken(rest), mnemonicBuffer);
+    std::string_view mnemonic = mnemonicBuffer;
+    if (mnemonic.size() > 3 && mnemonic.substr(mnemonic.size() - 3) == ".WT") mnemonic.remove_suffix(3);
+    if (mnemonic.empty() || mnemonic == "INCLUDE") return true;
+    if (mnemonic == "SECTION" || mnemonic == "GLOBAL" || mnemonic == "EXTERN") return !objectMode;
+    if (mnemonic == "ORG" || mnemonic == "DS") return false;
+    if (relaxBranches && mnemonic.length() == 3 && mnemonic[0] == 'B') return false;
+    size = static_cast<uint32_t>(textSize(mnemonic, rest));
+    return !(optimize && size == 3 && (mnemonic == "JMP" || mnemonic == "LD.W"));
+}
+
+// Marks every short branch whose target lies out of range at the addresses of the last
+// pass 1. Targets that do not evaluate are left for pass 2 to report. Returns true if any
+// branch was widened.
+bool Assembler::widenOutOfRangeBranches() {
+    bool widened = false;
+    for (const BranchSite& site : branchSites) {
+        int32_t target;
+        if (evaluateExpression(site.target, target)) {
+            // A target in another section or module is only placed by the linker.
+            const int offset = target - (site.address + 2);
+            if (expressionBase == site.section && offset >= -128 && offset <= 127) continue;
+        } else if (!site.isJump) {
             continue;
         }
+        // A shortened JMP whose target is unknown goes back to its full form.
+        lineWidened[site.lineIndex] = 1;
+        if (!site.isJump) stats.branchesRelaxed++;
+        widened = true;
+    }
+    return widened;
+}
 
+// Whether the flags set by line `index` are overwritten before anything can read them.
+// Only a few lines of straight-line code are examined and anything not known to leave the
+// flags alone counts as a reader, so a false answer just means the rewrite is skipped.
+// Pass 1 always runs over expandedLines.
+bool Assembler::flagsDeadAfter(size_t index) {
+    const size_t kScanLines = 8;
+    for (size_t next = index + 1; next < expandedLines.size() && next <= index + kScanLines; ++next) {
+        std::string_view line = stripComment(lineText(next));
+        std::string_view equRest = line;
+        nextToken(equRest);
+        if (equalsIgnoreCase(nextToken(equRest), "EQU")) continue;
         size_t colonPos = line.find(':');
-        if (colonPos != std::string::npos) line = trim(line.substr(colonPos + 1));
-        if (line.empty()) { instructions.push_back(inst); continue; }
+        if (colonPos != std::string_view::npos) line = trimView(line.substr(colonPos + 1));
+        if (line.empty()) continue;
 
-        std::stringstream ss(line);
-        std::string mnemonic; ss >> mnemonic; mnemonic = toUpper(mnemonic);
-        
-        bool isWT = false;
-        if (mnemonic.size() > 3 && mnemonic.substr(mnemonic.size()-3) == ".WT") {
-            mnemonic = mnemonic.substr(0, mnemonic.size()-3);
-            isWT = true;
+        std::string_view operands = line;
+        std::string_view mnemonic = nextToken(operands);
+        for (std::string_view rest = operands; !rest.empty();) {
+            size_t comma = rest.find(',');
+            if (parseRegister(rest.substr(0, comma)) == 4) return false; // reads or writes PS
+            rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
         }
 
-        if (mnemonic.empty()) { instructions.push_back(inst); continue; }
+        // Arithmetic sets N, Z, V and C from its own result.
+        for (const char* writer : {"ADD", "SUB", "CMP", "NEG", "ABS", "INC", "DEC", "ADDQ"}) {
+            if (equalsIgnoreCase(mnemonic, writer)) return true;
+        }
+        // Moves, loads and stores never read the flags.
+        const bool neutral = equalsIgnoreCase(mnemonic, "NOP") || equalsIgnoreCase(mnemonic, "MOVE") ||
+                             (mnemonic.size() == 4 && mnemonic[2] == '.' &&
+                              (equalsIgnoreCase(mnemonic.substr(0, 2), "LD") || equalsIgnoreCase(mnemonic.substr(0, 2), "ST")));
+        if (!neutral) return false;
+    }
+    return false;
+}
 
-        std::vector<uint8_t>& bytes = inst.bytes;
-        std::string rest; std::getline(ss, rest);
+// Records a rewrite of one instruction into a shorter one. The cycles saved follow the same
+// estimate as the listing's cycle column.
+void Assembler::countRewrite(uint8_t oldOpcode, uint32_t oldLength, uint8_t newOpcode, uint32_t newLength) {
+    stats.peepholeRewrites++;
+    stats.peepholeBytesSaved += oldLength - newLength;
+    stats.peepholeCyclesSaved += estimateCycles(oldOpcode, oldLength) - estimateCycles(newOpcode, newLength);
+}
 
-        std::vector<std::string> opList = split(rest, ',');
-        std::string op1 = opList.size() > 0 ? opList[0] : "";
-        std::string op2 = opList.size() > 1 ? opList[1] : "";
+void Assembler::pass2(const std::vector<std::string_view>& lines) {
+    currentAddress = 0;
+    instructions.reserve(lines.size());
+    resetSections();
+    if (!objectMode && pass2Parallel(lines)) return;
+    pass2Range(lines, 0, lines.size());
+}
 
-        if (mnemonic == "INCLUDE") {
-            inst.isDirective = true;
-        } else if (mnemonic == "ORG") {
-            int32_t val;
-            if (!evaluateExpression(op1, val)) {
-                error = "Invalid ORG expression at line " + std::to_string(lineNum) + ": " + expressionError;
-                return false;
-            }
-            currentAddress = (uint16_t)val;
-            inst.address = currentAddress;
-            inst.isDirective = true;
-        } else if (mnemonic == "DB" || mnemonic == "DW" || mnemonic == "DL") {
-            if (opList.empty()) {
-                bytes.push_back(0x00);
-                if (mnemonic == "DW" || mnemonic == "DL") bytes.push_back(0x00);
-                if (mnemonic == "DL") { bytes.push_back(0x00); bytes.push_back(0x00); }
-            } else {
-                for (auto& v : opList) {
-                    int32_t val;
-                    if (!evaluateExpression(v, val)) {
-                        error = "Invalid " + mnemonic + " value at line " + std::to_string(lineNum) + ": " + expressionError;
-                        return false;
-                    }
-                    bytes.push_back((uint8_t)(val & 0xFF));
-                    if (mnemonic == "DW" || mnemonic == "DL") bytes.push_back((uint8_t)((val >> 8) & 0xFF));
-                    if (mnemonic == "DL") {
-                        bytes.push_back((uint8_t)((val >> 16) & 0xFF));
-                        bytes.push_back((uint8_t)((val >> 24) & 0xFF));
-                    }
-                }
-            }
-        } else if (mnemonic == "DM") {
-            std::string t = trim(rest);
-            if (t.size() >= 2 && ((t.front() == '"' && t.back() == '"') || (t.front() == '\'' && t.back() == '\''))) {
-                std::string content = t.substr(1, t.size() - 2);
-                for (char c : content) bytes.push_back((uint8_t)c);
-                bytes.push_back(0x00);
-            } else {
-                bytes.push_back(0x00);
+void Assembler::pass2Range(const std::vector<std::string_view>& lines, size_t begin, size_t end) {
+    std::string error;
+    for (size_t index = begin; index < end; ++index) {
+        const int lineNum = static_cast<int>(index) + 1;
+        const uint16_t lineStart = currentAddress;
+        const size_t firstByte = instructions.bytes.size();
+        const size_t firstRelocation = relocations.size();
+        pendingRelocation = 0;
+        bool ok = !owner->lineFailed[index] && pass2Line(owner->lineText(index), lineNum, error);
+        if (ok && pendingRelocation != 0) {
+            // A relocatable value went into a field the linker cannot patch (a byte, a
+            // DL, an offset...).
+            error = diagnose("E_RELOCATION", std::string_view(), "Relocatable value cannot be used here at line " + std::to_string(lineNum));
+            ok = false;
+        }
+        if (!ok) {
+            // Lines already rejected in pass 1 are not reported twice. A bad line emits no
+            // bytes but keeps its pass-1 size so every later address stays where pass 1 put it.
+            if (!owner->lineFailed[index]) reportError(lineNum, lines[index], error);
+            instructions.bytes.resize(firstByte);
+            relocations.resize(firstRelocation);
+            instructions.add(lineStart, index, firstByte, InstructionTable::FAILED);
+            currentAddress = static_cast<uint16_t>(lineStart + owner->lineSizes[index]);
+        }
+        if (objectMode) {
+            RelocationBase& section = relocationBases[currentSection];
+            section.size = std::max<uint32_t>(section.size, currentAddress);
+        }
+    }
+}
+
+// How many chunks `lineCount` lines are split into, with that many workers ready to read
+// this assembler's tables; below 2 the work stays serial. Object mode is never split.
+size_t Assembler::prepareWorkers(size_t lineCount, unsigned& threads) {
+    threads = parallelism == 0 ? std::max(1u, std::thread::hardware_concurrency()) : parallelism;
+    const size_t chunks = objectMode ? 0 : std::min<size_t>(threads, lineCount / kParallelChunkLines);
+    while (workers.size() < chunks) workers.push_back(std::make_unique<Assembler>());
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        Assembler& worker = *workers[chunk];
+        worker.owner = this;
+        worker.sourceText = sourceText;
+        worker.relaxBranches = relaxBranches;
+        worker.optimize = optimize;
+        worker.objectMode = false;
+        worker.currentSection = 0;
+        worker.stats = AssemblyStats();
+        worker.diagnostics.clear();
+    }
+    return chunks;
+}
+
+// Labels and text-fixed sizes for every line, found by the workers a chunk each so the
+// pass-1 sweep only binds labels and adds up sizes for most lines. A prefix sum of the
+// sizes could be split too, but binding the labels into the symbol table is serial anyway
+// and costs more than the additions.
+bool Assembler::presizeParallel(const std::vector<std::string_view>& lines) {
+    unsigned threads = 0;
+    const size_t chunks = prepareWorkers(lines.size(), threads);
+    if (chunks < 2) return false;
+
+    lineLabels.resize(lines.size());
+    linePresized.resize(lines.size());
+    runTasks(chunks, threads, [&](size_t chunk) {
+        Assembler& worker = *workers[chunk];
+        const size_t end = lines.size() * (chunk + 1) / chunks;
+        for (size_t index = lines.size() * chunk / chunks; index < end; ++index) {
+            linePresized[index] = worker.presizeLine(index, lineLabels[index], lineSizes[index]);
+        }
+    });
+    return true;
+}
+
+// Once pass 1 has fixed every symbol, a line encodes from nothing but its own text and
+// address, so a large program is cut into chunks that workers encode at once, each from
+// the address pass 1 gave its first line. The chunks are then appended in order. Only
+// flat programs qualify: sections and relocations carry state from line to line. If a
+// chunk does not end where the next one was assumed to start (an ORG whose value changed
+// between the passes) nothing is kept and the caller encodes serially.
+bool Assembler::pass2Parallel(const std::vector<std::string_view>& lines) {
+    unsigned threads = 0;
+    const size_t chunks = prepareWorkers(lines.size(), threads);
+    if (chunks < 2) return false;
+
+    auto chunkStart = [&lines, chunks](size_t chunk) { return lines.size() * chunk / chunks; };
+    runTasks(chunks, threads, [&](size_t chunk) {
+        Assembler& worker = *workers[chunk];
+        worker.instructions.clear();
+        worker.instructions.reserve(chunkStart(chunk + 1) - chunkStart(chunk));
+        worker.currentAddress = lineAddresses[chunkStart(chunk)];
+        worker.pass2Range(lines, chunkStart(chunk), chunkStart(chunk + 1));
+    });
+    for (size_t chunk = 0; chunk + 1 < chunks; ++chunk) {
+        if (workers[chunk]->currentAddress != lineAddresses[chunkStart(chunk + 1)]) return false;
+    }
+
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        const Assembler& worker = *workers[chunk];
+        const InstructionTable& part = worker.instructions;
+        const uint32_t rebase = static_cast<uint32_t>(instructions.bytes.size());
+        instructions.address.insert(instructions.address.end(), part.address.begin(), part.address.end());
+        instructions.lineIndex.insert(instructions.lineIndex.end(), part.lineIndex.begin(), part.lineIndex.end());
+        for (uint32_t offset : part.byteOffset) instructions.byteOffset.push_back(offset + rebase);
+        instructions.length.insert(instructions.length.end(), part.length.begin(), part.length.end());
+        instructions.flags.insert(instructions.flags.end(), part.flags.begin(), part.flags.end());
+        instructions.bytes.insert(instructions.bytes.end(), part.bytes.begin(), part.bytes.end());
+        diagnostics.insert(diagnostics.end(), worker.diagnostics.begin(), worker.diagnostics.end());
+        stats.expressionEvaluations += worker.stats.expressionEvaluations;
+        stats.peepholeRewrites += worker.stats.peepholeRewrites;
+        stats.peepholeBytesSaved += worker.stats.peepholeBytesSaved;
+        stats.peepholeCyclesSaved += worker.stats.peepholeCyclesSaved;
+    }
+    currentAddress = workers[chunks - 1]->currentAddress;
+    return true;
+}
+
+void Assembler::resetSections() {
+    for (RelocationBase& base : relocationBases) {
+        base.location = 0;
+        base.size = 0;
+    }
+    currentSection = objectMode ? 1 : 0;
+    relocations.clear();
+    sectionChanges.clear();
+    if (objectMode) sectionChanges.push_back({0, 1});
+}
+
+// Leaves the current section, remembering where it stopped, and continues the named one
+// (created on first use) from where it left off.
+void Assembler::switchSection(std::string_view name) {
+    relocationBases[currentSection].location = currentAddress;
+    size_t index = 1;
+    while (index < relocationBases.size() && (relocationBases[index].isExtern || relocationBases[index].name != name)) ++index;
+    if (index == relocationBases.size()) relocationBases.push_back({name, false, 0, 0});
+    currentSection = static_cast<uint16_t>(index);
+    currentAddress = relocationBases[index].location;
+}
+
+// An EXTERN symbol is defined as offset 0 from its own relocation base.
+void Assembler::declareExterns(std::string_view names) {
+    splitFields(names, ',', fields);
+    for (std::string_view name : fields) {
+        size_t index = 1;
+        while (index < relocationBases.size() && (!relocationBases[index].isExtern || relocationBases[index].name != name)) ++index;
+        if (index == relocationBases.size()) relocationBases.push_back({name, true, 0, 0});
+        defineSymbol(name) = {name, 0, EXTERNAL, true, static_cast<uint16_t>(index)};
+    }
+}
+
+void Assembler::checkExports(const std::vector<std::string_view>& lines) {
+    std::string error;
+    for (const Export& item : exports) {
+        const Symbol* sym = findSymbol(item.name);
+        if (sym == nullptr || !sym->isDefined || relocationBases[sym->base].isExtern) {
+            error = diagnose("E_SYMBOL", item.name, "GLOBAL symbol '" + std::string(item.name) + "' is not defined in this module at line " + std::to_string(item.line));
+            reportError(item.line, lines[item.line - 1], error);
+        }
+    }
+}
+
+// Writes the object text described in docs/object-format.md. Offsets are relative to the
+// start of their section; the linker places sections and patches every RELOC field.
+std::string Assembler::buildObject() {
+    std::string out = "MEGAOBJ 1\n";
+    char number[16];
+    auto appendNumber = [&](uint32_t value) {
+        const int length = std::snprintf(number, sizeof(number), " %04X", static_cast<unsigned int>(value));
+        out.append(number, static_cast<size_t>(length));
+    };
+
+    for (const RelocationBase& base : relocationBases) {
+        if (base.name.empty()) continue;
+        out += base.isExtern ? "EXTERN " : "SECTION ";
+        out.append(base.name);
+        if (!base.isExtern) appendNumber(base.size);
+        out += '\n';
+    }
+
+    // Contiguous bytes of one section share a DATA record of up to 32 bytes.
+    const uint32_t recordSize = 0x20;
+    std::string data;
+    uint16_t dataSection = 0;
+    uint32_t dataStart = 0;
+    uint32_t dataCount = 0;
+    auto flush = [&]() {
+        if (dataCount == 0) return;
+        out += "DATA ";
+        out.append(relocationBases[dataSection].name);
+        appendNumber(dataStart);
+        out += ' ';
+        out += data;
+        out += '\n';
+        data.clear();
+        dataCount = 0;
+    };
+
+    stats.bytesEmitted = 0;
+    size_t change = 0;
+    uint16_t section = 0;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        while (change < sectionChanges.size() && sectionChanges[change].first <= i) section = sectionChanges[change++].second;
+        const uint32_t length = instructions.length[i];
+        if (length == 0) continue;
+        stats.bytesEmitted += length;
+        const uint32_t offset = instructions.address[i];
+        if (instructions.flags[i] & InstructionTable::FILL) {
+            flush();
+            out += "FILL ";
+            out.append(relocationBases[section].name);
+            appendNumber(offset);
+            appendNumber(length);
+            out += ' ';
+            appendHexByte(out, instructions.byteAt(i, 0));
+            out += '\n';
+            continue;
+        }
+        for (uint32_t k = 0; k < length; ++k) {
+            if (dataCount == recordSize || (dataCount > 0 && (section != dataSection || dataStart + dataCount != offset + k))) flush();
+            if (dataCount == 0) {
+                dataSection = section;
+                dataStart = offset + k;
             }
-        } else if (mnemonic == "DS") {
-            int32_t count = 0;
-            int32_t fill = 0;
-            if (!opList.empty() && !trim(opList[0]).empty()) {
-                if (!evaluateExpression(opList[0], count)) {
-                    error = "Invalid DS count at line " + std::to_string(lineNum) + ": " + expressionError;
+            appendHexByte(data, instructions.byteAt(i, k));
+            ++dataCount;
+        }
+    }
+    flush();
+
+    for (const Export& item : exports) {
+        const Symbol* sym = findSymbol(item.name);
+        out += "GLOBAL ";
+        out.append(item.name);
+        out += ' ';
+        if (sym->base == 0) out += '*';
+        else out.append(relocationBases[sym->base].name);
+        appendNumber(static_cast<uint16_t>(sym->value));
+        out += '\n';
+    }
+    for (const Relocation& relocation : relocations) {
+        const RelocationBase& base = relocationBases[relocation.base];
+        out += "RELOC ";
+        out.append(relocationBases[relocation.section].name);
+        appendNumber(relocation.offset);
+        out += base.isExtern ? " EXTERN " : " SECTION ";
+        out.append(base.name);
+        out += '\n';
+    }
+    out += "END\n";
+    return out;
+}
+
+// Encodes one line into the instruction table. Returns false with `error` set if the line
+// is invalid; the caller then discards whatever was appended.
+bool Assembler::pass2Line(std::string_view rawLine, int lineNum, std::string& error) {
+    error.clear();
+    const uint8_t marks = owner->expandedMarks[lineNum - 1];
+    std::string_view line = stripComment(rawLine, marks);
+
+    std::vector<uint8_t>& bytes = instructions.bytes;
+    const size_t firstByte = bytes.size();
+    const size_t lineIndex = static_cast<size_t>(lineNum - 1);
+    uint8_t flags = 0;
+    uint16_t address = currentAddress;
+    lineFirstByte = firstByte;
+    if (line.empty()) { instructions.add(address, lineIndex, firstByte, flags); return true; }
+
+    std::string_view equRest = line;
+    std::string_view label = nextToken(equRest);
+    std::string_view equMnemonic = nextToken(equRest);
+    if (equalsIgnoreCase(equMnemonic, "EQU")) {
+        const Symbol* sym = findSymbol(label);
+        address = (sym == nullptr) ? currentAddress : static_cast<uint16_t>(sym->value);
+        instructions.add(address, lineIndex, firstByte, InstructionTable::DIRECTIVE);
+        return true;
+    }
+
+    size_t colonPos = findColon(line, marks);
+    if (colonPos != std::string_view::npos) line = trimView(line.substr(colonPos + 1));
+    if (line.empty()) { instructions.add(address, lineIndex, firstByte, flags); return true; }
+
+    std::string_view rest = line;
+    std::string_view mnemonicToken = nextToken(rest);
+    toUpperInto(mnemonicToken, mnemonicBuffer);
+    std::string_view mnemonic = mnemonicBuffer;
+    
+    bool isWT = false;
+    if (mnemonic.size() > 3 && mnemonic.substr(mnemonic.size()-3) == ".WT") {
+        mnemonic.remove_suffix(3);
+        isWT = true;
+    }
+
+    if (mnemonic.empty()) { instructions.add(address, lineIndex, firstByte, flags); return true; }
+
+    size_t opCount;
+    if ((marks & LINE_HAS_COMMA) == 0) {
+        // At most one operand: skip the delimiter search.
+        fields.clear();
+        std::string_view operand = trimView(rest);
+        if (!rest.empty()) fields.push_back(operand);
+        opCount = fields.size();
+    } else {
+        opCount = splitFields(rest, ',', fields);
+    }
+    std::string_view op1 = opCount > 0 ? fields[0] : std::string_view();
+    std::string_view op2 = opCount > 1 ? fields[1] : std::string_view();
+    auto opcode = opcodeMap.find(mnemonic);
+
+    if (mnemonic == "INCLUDE") {
+        flags |= InstructionTable::DIRECTIVE;
+    } else if (mnemonic == "SECTION" || mnemonic == "GLOBAL" || mnemonic == "EXTERN") {
+        if (objectMode && mnemonic == "SECTION") {
+            switchSection(nextToken(rest));
+            address = currentAddress;
+            sectionChanges.push_back({static_cast<uint32_t>(instructions.size()), currentSection});
+        }
+        flags |= InstructionTable::DIRECTIVE;
+    } else if (mnemonic == "ORG") {
+        int32_t val;
+        if (!evaluateExpression(op1, val)) {
+            error = diagnose("E_EXPRESSION", op1, "Invalid ORG expression at line " + std::to_string(lineNum) + ": " + expressionError());
+            return false;
+        }
+        currentAddress = (uint16_t)val;
+        address = currentAddress;
+        flags |= InstructionTable::DIRECTIVE;
+    } else if (mnemonic == "DB" || mnemonic == "DW" || mnemonic == "DL") {
+        flags |= InstructionTable::DATA;
+        if (opCount == 0) {
+            bytes.push_back(0x00);
+            if (mnemonic == "DW" || mnemonic == "DL") bytes.push_back(0x00);
+            if (mnemonic == "DL") { bytes.push_back(0x00); bytes.push_back(0x00); }
+        } else {
+            for (std::string_view v : fields) {
+                int32_t val;
+                if (!evaluateExpression(v, val)) {
+                    error = diagnose("E_EXPRESSION", v, "Invalid " + std::string(mnemonic) + " value at line " + std::to_string(lineNum) + ": " + expressionError());
                     return false;
                 }
-            }
-            if (opList.size() > 1 && !trim(opList[1]).empty()) {
-                if (!evaluateExpression(opList[1], fill)) {
-                    error = "Invalid DS fill at line " + std::to_string(lineNum) + ": " + expressionError;
-                    return false;
+                if (mnemonic == "DW") noteRelocation();
+                bytes.push_back((uint8_t)(val & 0xFF));
+                if (mnemonic == "DW" || mnemonic == "DL") bytes.push_back((uint8_t)((val >> 8) & 0xFF));
+                if (mnemonic == "DL") {
+                    bytes.push_back((uint8_t)((val >> 16) & 0xFF));
+                    bytes.push_back((uint8_t)((val >> 24) & 0xFF));
                 }
             }
-            if (count < 0) {
-                error = "Negative DS count at line " + std::to_string(lineNum);
+        }
+    } else if (mnemonic == "DM") {
+        flags |= InstructionTable::DATA;
+        std::string_view t = trimView(rest);
+        if (isQuoted(t)) {
+            std::string_view content = t.substr(1, t.size() - 2);
+            for (char c : content) bytes.push_back((uint8_t)c);
+            bytes.push_back(0x00);
+        } else {
+            bytes.push_back(0x00);
+        }
+    } else if (mnemonic == "DS") {
+        int32_t count = 0;
+        int32_t fill = 0;
+        if (opCount > 0 && !fields[0].empty()) {
+            if (!evaluateExpression(fields[0], count)) {
+                error = diagnose("E_EXPRESSION", fields[0], "Invalid DS count at line " + std::to_string(lineNum) + ": " + expressionError());
+                return false;
+            }
+        }
+        // "DS n,?" reserves the space without emitting anything, like a BSS section.
+        const bool reserveOnly = opCount > 1 && fields[1] == "?";
+        if (opCount > 1 && !fields[1].empty() && !reserveOnly) {
+            if (!evaluateExpression(fields[1], fill)) {
+                error = diagnose("E_EXPRESSION", fields[1], "Invalid DS fill at line " + std::to_string(lineNum) + ": " + expressionError());
                 return false;
             }
-            for (int32_t i = 0; i < count; ++i) bytes.push_back((uint8_t)(fill & 0xFF));
-        } else if (opcodeMap.count(mnemonic) && mnemonic[0] == 'B') {
-            int32_t target;
-            if (!evaluateExpression(op1, target)) {
-                error = "Invalid branch target at line " + std::to_string(lineNum) + ": " + expressionError;
+        }
+        if (count < 0) {
+            error = diagnose("E_VALUE_RANGE", rest, "Negative DS count at line " + std::to_string(lineNum));
+            return false;
+        }
+        if (reserveOnly) {
+            instructions.add(address, lineIndex, firstByte, InstructionTable::DIRECTIVE);
+        } else if (count > 0) {
+            instructions.addFill(address, lineIndex, (uint8_t)(fill & 0xFF), static_cast<uint32_t>(count));
+        } else {
+            instructions.add(address, lineIndex, firstByte, flags);
+        }
+        currentAddress += count;
+        return true;
+    } else if (opcode != opcodeMap.end() && mnemonic[0] == 'B') {
+        int32_t target;
+        if (!evaluateExpression(op1, target)) {
+            error = diagnose("E_EXPRESSION", op1, "Invalid branch target at line " + std::to_string(lineNum) + ": " + expressionError());
+            return false;
+        }
+        if (relaxBranches && owner->lineWidened[lineNum - 1]) {
+            // BUC becomes JMP; any other condition skips over a JMP when it is false.
+            if (opcode->second != 0xE0) {
+                bytes.push_back(opcode->second ^ 0x01);
+                bytes.push_back(0x03);
+            }
+            bytes.push_back(0xF3);
+            noteRelocation();
+            bytes.push_back((uint8_t)(target & 0xFF));
+            bytes.push_back((uint8_t)((target >> 8) & 0xFF));
+        } else {
+            if (expressionBase != currentSection) {
+                error = diagnose("E_RELOCATION", op1, "Branch target must be in the same section at line " + std::to_string(lineNum));
                 return false;
             }
+            pendingRelocation = 0;
             int offset = target - (currentAddress + 2);
             if (offset < -128 || offset > 127) {
-                error = "Branch out of range at line " + std::to_string(lineNum);
+                error = diagnose("E_BRANCH_RANGE", op1, "Branch out of range at line " + std::to_string(lineNum));
                 return false;
             }
-            bytes.push_back(opcodeMap[mnemonic]);
+            bytes.push_back(opcode->second);
             bytes.push_back((uint8_t)(offset & 0xFF));
-        } else if (mnemonic == "JMP" || mnemonic == "JSR") {
-            if (op1.find('(') != std::string::npos) {
-                bytes.push_back(mnemonic == "JMP" ? 0xF2 : 0xCE);
-            } else {
-                int32_t target = 0;
-                bool hasTarget = false;
-
-                std::string targetSym = toUpper(trim(op1));
-                if (!targetSym.empty() && targetSym.back() == ';') targetSym.pop_back();
-                targetSym = toUpper(trim(targetSym));
-
-                bool isSimpleSymbol = !targetSym.empty() &&
-                                      (std::isalpha(static_cast<unsigned char>(targetSym[0])) || targetSym[0] == '_');
-                for (size_t i = 1; isSimpleSymbol && i < targetSym.size(); ++i) {
-                    if (!(std::isalnum(static_cast<unsigned char>(targetSym[i])) || targetSym[i] == '_')) {
-                        isSimpleSymbol = false;
-                    }
+        }
+    } else if (mnemonic == "JMP" || mnemonic == "JSR") {
+        if (op1.find('(') != std::string_view::npos) {
+            bytes.push_back(mnemonic == "JMP" ? 0xF2 : 0xCE);
+        } else {
+            int32_t target = 0;
+            bool hasTarget = false;
+
+            std::string_view targetSym = trimView(op1);
+            if (!targetSym.empty() && targetSym.back() == ';') targetSym.remove_suffix(1);
+            targetSym = trimView(targetSym);
+
+            bool isSimpleSymbol = !targetSym.empty() &&
+                                  (std::isalpha(static_cast<unsigned char>(targetSym[0])) || targetSym[0] == '_');
+            for (size_t i = 1; isSimpleSymbol && i < targetSym.size(); ++i) {
+                if (!(std::isalnum(static_cast<unsigned char>(targetSym[i])) || targetSym[i] == '_')) {
+                    isSimpleSymbol = false;
                 }
+            }
 
-                if (isSimpleSymbol) {
-                    auto it = symbolTable.find(targetSym);
-                    if (it != symbolTable.end() && it->second.isDefined) {
-                        target = it->second.value;
-                        hasTarget = true;
-                    }
+            if (isSimpleSymbol) {
+                const Symbol* sym = findSymbol(targetSym);
+                if (sym != nullptr && sym->isDefined) {
+                    target = sym->value;
+                    if (sym->base != 0) pendingRelocation = sym->base;
+                    hasTarget = true;
                 }
+            }
 
-                if (!hasTarget && !evaluateExpression(op1, target)) {
-                    error = "Invalid jump target at line " + std::to_string(lineNum) + ": " + expressionError;
-                    return false;
-                }
+            if (!hasTarget && !evaluateExpression(op1, target)) {
+                error = diagnose("E_EXPRESSION", op1, "Invalid jump target at line " + std::to_string(lineNum) + ": " + expressionError());
+                return false;
+            }
 
+            if (owner->lineRewrite[lineIndex] == REWRITE_SHORT_JUMP) {
+                // Pass 1 only kept this short after checking the range.
+                bytes.push_back(0xE0);
+                bytes.push_back((uint8_t)((target - (currentAddress + 2)) & 0xFF));
+                pendingRelocation = 0;
+                countRewrite(0xF3, 3, 0xE0, 2);
+            } else {
                 bytes.push_back(mnemonic == "JMP" ? 0xF3 : 0xCF);
+                noteRelocation();
                 bytes.push_back((uint8_t)(target & 0xFF));
                 bytes.push_back((uint8_t)((target >> 8) & 0xFF));
             }
-        } else if (mnemonic.rfind("LD.", 0) == 0 || mnemonic.rfind("ST.", 0) == 0) {
-            encodeLoadStore(mnemonic, op1, op2, bytes, lineNum, error);
-            if (!error.empty()) return false;
-        } else if (mnemonic == "MOVE" || mnemonic == "AND" || mnemonic == "XOR" || mnemonic == "OR" || 
-                   mnemonic == "ADD" || mnemonic == "SUB" || mnemonic == "CMP" || mnemonic == "TEST" ||
-                   mnemonic == "SXT" || mnemonic == "ABS" || mnemonic == "INV" || mnemonic == "NEG" ||
-                   mnemonic == "CLR" || mnemonic == "INC" || mnemonic == "DEC" || mnemonic == "ADDQ") {
-             encodeALU(mnemonic, op1, op2, bytes, lineNum, error);
-             if (!error.empty()) return false;
-
-        } else if (mnemonic == "PUSH" || mnemonic == "POP") {
-            int r = parseRegister(op1);
-            if (r < 0) {
-                std::string rStr = toUpper(trim(op1));
-                if (rStr == "PS") r = 4;
-                else {
-                    error = "Invalid register in " + mnemonic + " at line " + std::to_string(lineNum);
-                    return false;
-                }
-            }
-            bytes.push_back((mnemonic == "POP" ? 0xC0 : 0xC8) + r);
-        } else if (mnemonic == "RET") {
-            bytes.push_back(0xC6);
-        } else if (mnemonic == "RETI") {
-            bytes.push_back(0xC7);
-        } else if (mnemonic == "TRAP") {
-            bytes.push_back(0xCD);
-        } else if (mnemonic == "ASL" || mnemonic == "ASR" || mnemonic == "LSL" || mnemonic == "LSR" ||
-                   mnemonic == "ROL" || mnemonic == "ROR" || mnemonic == "ROXL" || mnemonic == "ROXR") {
-            int r = parseRegister(op1);
-            if (r < 0) {
-                error = "Invalid register in " + mnemonic + " at line " + std::to_string(lineNum);
+        }
+    } else if (owner->lineRewrite[lineIndex] == REWRITE_LOAD_ZERO) {
+        const int reg = parseRegister(op1);
+        bytes.push_back(getALUOpcode("CLR", reg, reg));
+        countRewrite(static_cast<uint8_t>(0xD0 + reg), 3, bytes.back(), 1);
+    } else if (mnemonic.rfind("LD.", 0) == 0 || mnemonic.rfind("ST.", 0) == 0) {
+        encodeLoadStore(mnemonic, op1, op2, bytes, lineNum, error);
+        if (!error.empty()) return false;
+    } else if (mnemonic == "MOVE" || mnemonic == "AND" || mnemonic == "XOR" || mnemonic == "OR" || 
+               mnemonic == "ADD" || mnemonic == "SUB" || mnemonic == "CMP" || mnemonic == "TEST" ||
+               mnemonic == "SXT" || mnemonic == "ABS" || mnemonic == "INV" || mnemonic == "NEG" ||
+               mnemonic == "CLR" || mnemonic == "INC" || mnemonic == "DEC" || mnemonic == "ADDQ") {
+         encodeALU(mnemonic, op1, op2, bytes, lineNum, error);
+         if (!error.empty()) return false;
+
+    } else if (mnemonic == "PUSH" || mnemonic == "POP") {
+        int r = parseRegister(op1);
+        if (r < 0) {
+            if (equalsIgnoreCase(trimView(op1), "PS")) r = 4;
+            else {
+                error = diagnose("E_REGISTER", op1, "Invalid register in " + std::string(mnemonic) + " at line " + std::to_string(lineNum));
                 return false;
             }
+        }
+        bytes.push_back((mnemonic == "POP" ? 0xC0 : 0xC8) + r);
+    } else if (mnemonic == "RET") {
+        bytes.push_back(0xC6);
+    } else if (mnemonic == "RETI") {
+        bytes.push_back(0xC7);
+    } else if (mnemonic == "TRAP") {
+        bytes.push_back(0xCD);
+    } else if (mnemonic == "ASL" || mnemonic == "ASR" || mnemonic == "LSL" || mnemonic == "LSR" ||
+               mnemonic == "ROL" || mnemonic == "ROR" || mnemonic == "ROXL" || mnemonic == "ROXR") {
+        int r = parseRegister(op1);
+        if (r < 0) {
+            error = diagnose("E_REGISTER", op1, "Invalid register in " + std::string(mnemonic) + " at line " + std::to_string(lineNum));
+            return false;
+        }
 
-            int type = 0; // LSL/LSR
-            if (mnemonic == "ASL" || mnemonic == "ASR") type = 2;
-            else if (mnemonic == "ROL" || mnemonic == "ROR") type = 4;
-            else if (mnemonic == "ROXL" || mnemonic == "ROXR") type = 6;
-
-            bool isRight = (mnemonic.back() == 'R');
-            bool isRegShift = false;
-            int shiftVal = 0;
-            int srcReg = -1;
+        int type = 0; // LSL/LSR
+        if (mnemonic == "ASL" || mnemonic == "ASR") type = 2;
+        else if (mnemonic == "ROL" || mnemonic == "ROR") type = 4;
+        else if (mnemonic == "ROXL" || mnemonic == "ROXR") type = 6;
 
-            if (op2.empty()) {
-                 error = "Missing operand for " + mnemonic + " at line " + std::to_string(lineNum);
-                 return false;
-            }
+        bool isRight = (mnemonic.back() == 'R');
+        bool isRegShift = false;
+        int shiftVal = 0;
+        int srcReg = -1;
 
-            srcReg = parseRegister(op2);
-            if (srcReg >= 0) {
-                isRegShift = true;
-            } else {
-                std::string valStr = op2;
-                if (valStr[0] == '#') valStr = valStr.substr(1);
-                if (!evaluateExpression(valStr, shiftVal)) {
-                    error = "Invalid shift value at line " + std::to_string(lineNum) + ": " + expressionError;
-                    return false;
-                }
-                if (isRight) shiftVal = -shiftVal;
-            }
+        if (op2.empty()) {
+             error = diagnose("E_OPERAND", rest, "Missing operand for " + std::string(mnemonic) + " at line " + std::to_string(lineNum));
+             return false;
+        }
 
-            uint8_t opByte;
-            if (isRegShift) {
-                opByte = ((type | 1) << 5) | (srcReg & 0x03);
-            } else {
-                opByte = (type << 5) | (shiftVal & 0x1F);
-            }
-            if (isWT) opByte |= 0x08;
-
-            bytes.push_back(0xD8 + r);
-            bytes.push_back(opByte);
-
-        } else if (mnemonic == "BTST" || mnemonic == "BCHG" || mnemonic == "BCLR" || mnemonic == "BSET") {
-            encodeBitOp(mnemonic, op1, op2, bytes, lineNum, error);
-            if (!error.empty()) return false;
-        } else if (mnemonic == "ANDI" || mnemonic == "ORI" || mnemonic == "ADDI") {
-            bytes.push_back(opcodeMap[mnemonic]);
-            std::string valStr = op2;
-            if (valStr.empty()) valStr = op1; // Fallback if only one operand? No, normally ps,#val
-            if (!valStr.empty() && valStr[0] == '#') valStr = valStr.substr(1);
-            int32_t val;
-            if (!evaluateExpression(valStr, val)) {
-                error = "Invalid immediate for " + mnemonic + " at line " + std::to_string(lineNum) + ": " + expressionError;
+        srcReg = parseRegister(op2);
+        if (srcReg >= 0) {
+            isRegShift = true;
+        } else {
+            std::string_view valStr = op2;
+            if (valStr[0] == '#') valStr.remove_prefix(1);
+            if (!evaluateExpression(valStr, shiftVal)) {
+                error = diagnose("E_EXPRESSION", valStr, "Invalid shift value at line " + std::to_string(lineNum) + ": " + expressionError());
                 return false;
             }
-            bytes.push_back((uint8_t)(val & 0xFF));
-        } else if (opcodeMap.count(mnemonic)) {
-            bytes.push_back(opcodeMap[mnemonic]);
+            if (isRight) shiftVal = -shiftVal;
+        }
+
+        uint8_t opByte;
+        if (isRegShift) {
+            opByte = ((type | 1) << 5) | (srcReg & 0x03);
         } else {
-            error = "Unknown instruction '" + mnemonic + "' at line " + std::to_string(lineNum);
+            opByte = (type << 5) | (shiftVal & 0x1F);
+        }
+        if (isWT) opByte |= 0x08;
+
+        bytes.push_back(0xD8 + r);
+        bytes.push_back(opByte);
+
+    } else if (mnemonic == "BTST" || mnemonic == "BCHG" || mnemonic == "BCLR" || mnemonic == "BSET") {
+        encodeBitOp(mnemonic, op1, op2, bytes, lineNum, error);
+        if (!error.empty()) return false;
+    } else if (mnemonic == "ANDI" || mnemonic == "ORI" || mnemonic == "ADDI") {
+        bytes.push_back(opcode->second);
+        std::string_view valStr = op2;
+        if (valStr.empty()) valStr = op1; // Fallback if only one operand? No, normally ps,#val
+        if (!valStr.empty() && valStr[0] == '#') valStr.remove_prefix(1);
+        int32_t val;
+        if (!evaluateExpression(valStr, val)) {
+            error = diagnose("E_EXPRESSION", valStr, "Invalid immediate for " + std::string(mnemonic) + " at line " + std::to_string(lineNum) + ": " + expressionError());
             return false;
         }
-        currentAddress += bytes.size();
-        instructions.push_back(inst);
+        bytes.push_back((uint8_t)(val & 0xFF));
+    } else if (opcode != opcodeMap.end()) {
+        bytes.push_back(opcode->second);
+    } else {
+        error = diagnose("E_UNKNOWN_INSTRUCTION", mnemonicToken, "Unknown instruction '" + std::string(mnemonic) + "' at line " + std::to_string(lineNum));
+        return false;
     }
-    LOGI("Finished Pass 2.");
+    currentAddress += bytes.size() - firstByte;
+    instructions.add(address, lineIndex, firstByte, flags);
     return true;
 }
 
-void Assembler::encodeLoadStore(const std::string& mnemonic, const std::string& op1, const std::string& op2,
+void Assembler::encodeLoadStore(std::string_view mnemonic, std::string_view op1, std::string_view op2,
                                 std::vector<uint8_t>& bytes, int lineNum, std::string& error) {
     bool isLoad = (mnemonic[0] == 'L');
     bool isByte = (mnemonic.size() > 3 && mnemonic[3] == 'B');
     int reg = parseRegister(isLoad ? op1 : op2);
-    std::string addrStr = isLoad ? op2 : op1;
+    std::string_view addrStr = isLoad ? op2 : op1;
 
     if (reg < 0) {
-        error = "Invalid register in LD/ST at line " + std::to_string(lineNum);
+        error = diagnose("E_REGISTER", (isLoad ? op1 : op2), "Invalid register in LD/ST at line " + std::to_string(lineNum));
         return;
     }
 
-    std::string addr = trim(addrStr);
-    bool wrapped = !addr.empty() && addr.front() == '(' && addr.find(')') != std::string::npos;
-    std::string inside = wrapped ? addr.substr(1, addr.find(')') - 1) : "";
-    std::string insideUpper = toUpper(trim(inside));
+    std::string_view addr = trimView(addrStr);
+    size_t closePos = addr.find(')');
+    bool wrapped = !addr.empty() && addr.front() == '(' && closePos != std::string_view::npos;
+    std::string_view inside = wrapped ? addr.substr(1, closePos - 1) : std::string_view();
 
-    if (wrapped && insideUpper.find("SP") != std::string::npos && inside.find('+') != std::string::npos) {
+    if (wrapped && findIgnoreCase(inside, "SP") != std::string_view::npos && inside.find('+') != std::string_view::npos) {
         size_t plusPos = inside.find('+');
-        std::string offsetStr = inside.substr(plusPos + 1);
+        std::string_view offsetStr = inside.substr(plusPos + 1);
         int32_t offset;
         if (!evaluateExpression(offsetStr, offset)) {
-            error = "Invalid SP offset at line " + std::to_string(lineNum) + ": " + expressionError;
+            error = diagnose("E_EXPRESSION", offsetStr, "Invalid SP offset at line " + std::to_string(lineNum) + ": " + expressionError());
             return;
         }
         uint8_t base = isLoad ? (isByte ? 0xA4 : 0xA0) : (isByte ? 0xAC : 0xA8);
         bytes.push_back(base + reg);
         bytes.push_back((uint8_t)(offset & 0xFF));
-    } else if (wrapped && inside.find("++") != std::string::npos) {
-        int ptrReg = (insideUpper.find("R2") != std::string::npos) ? 2 : 3;
+    } else if (wrapped && inside.find("++") != std::string_view::npos) {
+        int ptrReg = (findIgnoreCase(inside, "R2") != std::string_view::npos) ? 2 : 3;
         uint8_t base = 0x90;
         if (!isLoad) base += 8;
         if (isByte) base += 4;
@@ -992,7 +2580,7 @@ void Assembler::encodeLoadStore(const std::string& mnemonic, const std::string&
         if (reg == 1) base += 1;
         bytes.push_back(base);
     } else if (wrapped) {
-        int ptrReg = (insideUpper.find("R2") != std::string::npos) ? 2 : 3;
+        int ptrReg = (findIgnoreCase(inside, "R2") != std::string_view::npos) ? 2 : 3;
         uint8_t base = 0x80;
         if (!isLoad) base += 8;
         if (isByte) base += 4;
@@ -1002,20 +2590,22 @@ void Assembler::encodeLoadStore(const std::string& mnemonic, const std::string&
     } else if (!addr.empty() && addr[0] == '#') {
         int32_t value;
         if (!evaluateExpression(addr.substr(1), value)) {
-            error = "Invalid immediate at line " + std::to_string(lineNum) + ": " + expressionError;
+            error = diagnose("E_EXPRESSION", addr, "Invalid immediate at line " + std::to_string(lineNum) + ": " + expressionError());
             return;
         }
         bytes.push_back(isByte ? (0xD4 + reg) : (0xD0 + reg));
+        if (!isByte) noteRelocation();
         bytes.push_back((uint8_t)(value & 0xFF));
         if (!isByte) bytes.push_back((uint8_t)((value >> 8) & 0xFF));
     } else {
         int32_t addressValue;
         if (!evaluateExpression(addr, addressValue)) {
-            error = "Invalid address expression at line " + std::to_string(lineNum) + ": " + expressionError;
+            error = diagnose("E_EXPRESSION", addr, "Invalid address expression at line " + std::to_string(lineNum) + ": " + expressionError());
             return;
         }
         uint8_t base = isLoad ? (isByte ? 0xB4 : 0xB0) : (isByte ? 0xBC : 0xB8);
         bytes.push_back(base + reg);
+        noteRelocation();
         bytes.push_back((uint8_t)(addressValue & 0xFF));
         bytes.push_back((uint8_t)((addressValue >> 8) & 0xFF));
     }
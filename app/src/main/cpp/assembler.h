@@ -2,73 +2,518 @@
 #define ASSEMBLER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <cstdint>
-#include <sstream>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "arena.h"
 
 enum SymbolType {
     LABEL,
-    CONSTANT
+    CONSTANT,
+    EXTERNAL
 };
 
+// Symbol names point into the source text or the assembler's arena and stay valid
+// until the next call to assemble(). `base` is 0 for absolute values; when assembling an
+// object it names the section (or EXTERN symbol) the value is relative to.
 struct Symbol {
-    std::string name;
+    std::string_view name;
     int32_t value;
     SymbolType type;
     bool isDefined;
+    uint16_t base = 0;
+};
+
+// Counters collected during the last assemble() call. Times are wall-clock milliseconds;
+// allocations stay at 0 unless the host installed a counter with setAllocationCounter().
+struct AssemblyStats {
+    double preprocessMs;
+    double pass1Ms;
+    double pass2Ms;
+    double hexMs;
+    double listingMs;
+    size_t sourceLines;
+    size_t expandedLines;
+    size_t includesExpanded;
+    size_t symbolCount;
+    size_t bytesEmitted;
+    uint64_t expressionEvaluations;
+    uint64_t allocations;
+    size_t branchesRelaxed;
+    size_t relaxationPasses;
+    size_t peepholeRewrites;
+    size_t peepholeBytesSaved;
+    size_t peepholeCyclesSaved;
+};
+
+// One problem found while assembling. `line` is the 1-based line of the expanded source,
+// the same number the listing and error messages use; `column` is 1-based and 0 when the
+// position is not known. `code` is a stable identifier such as "E_UNKNOWN_INSTRUCTION".
+struct Diagnostic {
+    int line;
+    int column;
+    std::string code;
+    std::string message;
+};
+
+std::string diagnosticsToJson(const std::vector<Diagnostic>& diagnostics);
+
+// Where the last assembly put its bytes. Ranges never cross 0xFFFF; `length` is a count
+// so a range may cover the whole 64 KB.
+struct MemoryRange {
+    uint16_t start;
+    uint32_t length;
 };
 
-struct Instruction {
+// Bytes emitted from a label up to the next label or the end of its region, which for
+// a subroutine is its code size.
+struct LabelExtent {
+    std::string name;
     uint16_t address;
+    uint32_t bytes;
+};
+
+// Bytes emitted by the lines of one file; the main source has an empty name.
+struct FileUsage {
+    std::string file;
+    uint32_t bytes;
+};
+
+// `length` bytes from `address` are written by line `secondLine` after line `firstLine`
+// already wrote them. The later line wins when the HEX is loaded.
+struct MemoryOverlap {
+    uint16_t address;
+    uint32_t length;
+    int firstLine;
+    int secondLine;
+};
+
+struct MemoryMap {
+    uint32_t usedBytes = 0;
+    std::vector<MemoryRange> regions;
+    std::vector<MemoryRange> gaps;
+    std::vector<LabelExtent> labels;
+    std::vector<FileUsage> files;
+    std::vector<MemoryOverlap> overlaps;
+};
+
+std::string memoryMapToJson(const MemoryMap& map);
+
+// Estimated execution time of the code from one label to the next label in source order,
+// stopping at the first data the code runs into. `straightCycles` counts every one of those
+// `instructions` once; `worstCycles` is the longest path through
+// the region's forward branches, or -1 when a branch inside it goes backwards (a loop, whose
+// bound depends on data). Subroutines the region calls are not included.
+struct CycleRegion {
+    std::string label;
+    uint16_t address;
+    int line;        // within `file`
+    int listingLine; // in the expanded source, as the listing numbers it
+    std::string file;
+    uint32_t instructions;
+    uint64_t straightCycles;
+    int64_t worstCycles;
+};
+
+std::string cycleRegionsToJson(const std::vector<CycleRegion>& regions);
+
+// The source line that emitted `length` bytes at `address`: `line` counts within `file`
+// (empty for the main source), `listingLine` within the expanded source as the listing
+// numbers it. Bytes from a macro or REPT expansion map to the line of the call. `code` is
+// false for DB/DW/DL/DM and DS fill.
+struct LineMapEntry {
+    uint16_t address;
+    uint32_t length;
+    int line;
+    int listingLine;
+    std::string_view file;
+    bool code;
+};
+
+std::string lineMapToJson(const std::vector<LineMapEntry>& entries);
+
+// Returns the number of heap allocations made by the process so far.
+typedef uint64_t (*AllocationCounter)();
+
+std::string statsToJson(const AssemblyStats& stats);
+
+// Pass 2 output, one entry per expanded source line, stored column-wise. Entry i
+// covers line lineIndex[i] and its encoded bytes are bytes[byteOffset[i] ..
+// byteOffset[i] + length[i]); all entries share the one byte pool. A FILL entry is
+// run-length encoded instead: length[i] copies of the single byte at bytes[byteOffset[i]].
+struct InstructionTable {
+    enum Flag : uint8_t {
+        DIRECTIVE = 1,
+        FAILED = 2,
+        FILL = 4,
+        DATA = 8
+    };
+
+    std::vector<uint16_t> address;
+    std::vector<uint32_t> lineIndex;
+    std::vector<uint32_t> byteOffset;
+    std::vector<uint32_t> length;
+    std::vector<uint8_t> flags;
     std::vector<uint8_t> bytes;
-    std::string originalLine;
-    int lineNumber;
-    std::string errorMessage;
-    bool isDirective;
+
+    size_t size() const { return address.size(); }
+    void clear();
+    void reserve(size_t entries);
+    // Records an entry whose bytes were appended to `bytes` starting at `firstByte`.
+    void add(uint16_t entryAddress, size_t line, size_t firstByte, uint8_t entryFlags);
+    // Records `count` copies of `value` while storing the byte once.
+    void addFill(uint16_t entryAddress, size_t line, uint8_t value, uint32_t count);
+    uint8_t byteAt(size_t entry, uint32_t offset) const {
+        return bytes[byteOffset[entry] + ((flags[entry] & FILL) ? 0 : offset)];
+    }
 };
 
+// An INCLUDE directive found by scanIncludeDirectives(). `line` is the 0-based line index
+// within its file, `path` the operand as written (quotes removed) and `name` its
+// upper-case form, which is how include files are looked up.
+struct IncludeDirective {
+    uint32_t line;
+    std::string path;
+    std::string name;
+};
+
+// Include directives per file, keyed by include name; the main source uses the empty key.
+typedef std::map<std::string, std::vector<IncludeDirective>, std::less<>> IncludeGraph;
+
+// Finds INCLUDE directives exactly as the assembler's preprocessor does, honouring block
+// and line comments, without expanding anything.
+std::vector<IncludeDirective> scanIncludeDirectives(std::string_view text);
+
+typedef std::map<std::string_view, Symbol, std::less<>,
+                 ArenaAllocator<std::pair<const std::string_view, Symbol>>> SymbolTable;
+
 class Assembler {
 public:
     Assembler();
     std::string assemble(const std::string& sourceCode);
+    // Assembles a caller-owned buffer, such as a memory-mapped file, without copying it.
+    // The buffer must stay alive and unchanged until the next assemble call.
+    std::string assembleBuffer(std::string_view sourceCode);
     std::string getListing() const;
+    // Symbols of the last assembly, one "NAME<TAB>VALUE<TAB>LABEL|EQU" line each, sorted by
+    // their upper-case name. VALUE is hexadecimal, at least four digits.
+    std::string getSymbols() const;
     void setIncludeFiles(const std::map<std::string, std::string>& includeFiles);
+    // Like setIncludeFiles() but keeps views into the caller's buffers instead of copies.
+    void setIncludeBuffers(const std::map<std::string, std::string_view>& includeFiles);
+    // Supplies include directives already scanned by the host so preprocessing does not
+    // parse every line looking for them. Must describe the current include files and the
+    // next source; setIncludeFiles()/setIncludeBuffers() clear it.
+    void setIncludeGraph(const IncludeGraph& graph);
+    // When enabled, branches whose target is out of the -128..127 range are widened instead
+    // of rejected: BUC becomes JMP and a conditional branch becomes the inverted branch
+    // skipping over a JMP. Off by default, which keeps the original encoding byte for byte.
+    void setBranchRelaxation(bool enabled);
+    // When enabled, a table of size- and cycle-reducing rewrites is applied while encoding:
+    // LD.W Rx,#0 becomes CLR Rx when the flags it leaves are provably overwritten before
+    // use, and JMP to a target within branch range becomes BUC. Savings are reported in
+    // AssemblyStats; cycle savings compare the original and the rewritten instruction under
+    // the same cycle estimate the listing's cycle column uses.
+    void setPeepholeOptimization(bool enabled);
+    // When enabled, assemble() returns a relocatable object (see docs/object-format.md)
+    // instead of Intel HEX. SECTION, GLOBAL and EXTERN are honoured; in flat mode they are
+    // accepted and ignored so the same source can also be assembled as one program.
+    void setObjectOutput(bool enabled);
+    // Lets pass 2 encode a large flat program in up to `threads` chunks at once (0 means
+    // one per core). The output is byte-for-byte that of a serial run; 1, the default,
+    // keeps all the work on the calling thread.
+    void setParallelism(unsigned threads);
+    // Keyword knowledge for editors: whether `word`, in any case, is an instruction this
+    // assembler encodes (LD.W-style forms and the .WT shift suffix included) or one of its
+    // directives.
+    bool isMnemonic(std::string_view word) const;
+    static bool isDirective(std::string_view word);
+    const AssemblyStats& getStats() const;
+    // Every error of the last assembly, in source order within each phase. assemble()
+    // still returns "ERROR: " plus the first message when this is not empty.
+    const std::vector<Diagnostic>& getDiagnostics() const;
+    // Problems that do not stop the assembly, such as two ORG regions writing the same
+    // bytes (W_OVERLAP).
+    const std::vector<Diagnostic>& getWarnings() const;
+    // Occupied regions, free gaps, label sizes and bytes per include file of the last
+    // successful flat assembly. Built on request, not during assemble().
+    MemoryMap getMemoryMap() const;
+    // When enabled, the listing gets a column with the estimated cycles of each instruction.
+    // Off by default, which keeps the listing format unchanged.
+    void setCycleAnnotation(bool enabled);
+    // Cycle estimates per label of the last successful flat assembly, for budget checks. The
+    // figures come from a model (one cycle per byte on the bus plus internal cycles per
+    // opcode class), not from measured timings.
+    std::vector<CycleRegion> getCycleRegions() const;
+    // Address-to-line map of the last successful flat assembly, sorted by address; lines
+    // that write the same address appear in source order, the last one being what the HEX
+    // loads. File names stay valid until the next call to assemble().
+    std::vector<LineMapEntry> getLineMap() const;
+    static void setAllocationCounter(AllocationCounter counter);
 
 private:
-    std::map<std::string, Symbol> symbolTable;
-    std::vector<Instruction> instructions;
+    // A run of consecutive memory bytes taken from one instruction entry, starting at byte
+    // `first` of that entry. Entries crossing 0xFFFF are split in two.
+    struct ImageSegment {
+        uint16_t address;
+        uint32_t entry;
+        uint32_t first;
+        uint32_t length;
+    };
+
+    struct PendingEqu {
+        Symbol* symbol;
+        std::string_view expression;
+        int lineNumber;
+    };
+
+    // A relative branch seen by pass 1, kept so relaxation can re-check its range. Jumps
+    // are JMPs tentatively shortened to BUC by the optimizer.
+    struct BranchSite {
+        uint32_t lineIndex;
+        uint16_t address;
+        std::string_view target;
+        bool isJump;
+        uint16_t section;
+    };
+
+    // How pass 1 and pass 2 treat an expanded line. Directive lines (REPT, IF, macro calls...)
+    // only keep a leading "label:"; skipped lines (macro definitions, false IF branches)
+    // appear in the listing but are otherwise ignored.
+    enum LineKind : uint8_t {
+        LINE_SOURCE = 0,
+        LINE_EXPANDED,
+        LINE_LABEL_ONLY,
+        LINE_SKIPPED
+    };
+
+    // Parameters and body are views into the definition's lines.
+    struct MacroDefinition {
+        std::vector<std::string_view> parameters;
+        std::vector<std::string_view> body;
+    };
+
+    // One open IF block: the line that opened it, whether the enclosing code is assembled,
+    // whether a branch of this block was already taken, and whether the current one is active.
+    struct Conditional {
+        int line;
+        bool parentActive;
+        bool taken;
+        bool active;
+    };
+
+    // A section, or an EXTERN symbol, that relocatable values are relative to. Index 0 of
+    // relocationBases stands for "absolute".
+    struct RelocationBase {
+        std::string_view name;
+        bool isExtern;
+        uint16_t location;
+        uint32_t size;
+    };
+
+    // The 16-bit little-endian field at `offset` of `section` must have the final address of
+    // `base` added to it.
+    struct Relocation {
+        uint16_t section;
+        uint16_t offset;
+        uint16_t base;
+    };
+
+    struct Export {
+        std::string_view name;
+        int line;
+    };
+
+    enum Rewrite : uint8_t {
+        REWRITE_NONE = 0,
+        REWRITE_LOAD_ZERO,
+        REWRITE_SHORT_JUMP
+    };
+
+    // Declared first: the symbol table allocates from it.
+    Arena arena;
+    SymbolTable symbolTable;
+    InstructionTable instructions;
     uint16_t currentAddress;
     std::string listingOutput;
-    std::map<std::string, std::string> includeFileContents;
-    std::string expressionError;
+    // Keyed by normalized include name; the views point either into includeFileStorage
+    // (setIncludeFiles) or into buffers owned by the caller (setIncludeBuffers).
+    std::map<std::string, std::string, std::less<>> includeFileStorage;
+    std::map<std::string, std::string_view, std::less<>> includeFileContents;
+    IncludeGraph includeGraph;
+    // Why the last evaluateExpression() failed. An undefined symbol only leaves a view into
+    // expressionBuffer, valid until the next evaluation, so the forward references pass 1
+    // retries cost no message; expressionError() spells it out when it is reported.
+    std::string expressionFailure;
+    std::string_view unresolvedSymbol;
+    AssemblyStats stats;
+    std::vector<Diagnostic> diagnostics;
+    std::vector<Diagnostic> warnings;
+    std::string_view sourceText;
+    const char* errorCode = "";
+    std::string_view errorToken;
+
+    // Per-assembly working storage; cleared between runs but keeps its capacity.
+    std::vector<std::string_view> sourceLines;
+    std::vector<std::string_view> expandedLines;
+    std::vector<std::string_view> includeStack;
+    // One entry per include depth; a deque so growing it never moves the lines of the
+    // files still being expanded further up the stack.
+    std::deque<std::vector<std::string_view>> includeLines;
+    // LineMark bits from scanLines, parallel to sourceLines, includeLines and expandedLines.
+    // Lines the preprocessor generates get every bit.
+    std::vector<uint8_t> sourceMarks;
+    std::deque<std::vector<uint8_t>> includeMarks;
+    std::vector<uint8_t> expandedMarks;
+    uint8_t pendingMarks = 0;
+    // 1-based line, within its own file (see fileRuns), of the source line each expanded
+    // line came from; lines a macro or REPT generates carry the line of the call.
+    std::vector<uint32_t> expandedSourceLines;
+    uint32_t pendingSourceLine = 0;
+    std::vector<PendingEqu> pendingEQUs;
+    std::vector<uint32_t> lineSizes;
+    std::vector<uint8_t> lineFailed;
+    bool relaxBranches = false;
+    std::vector<BranchSite> branchSites;
+    std::vector<uint8_t> lineWidened;
+    bool optimize = false;
+    std::vector<uint8_t> lineRewrite;
+    // Address of every line as pass 1 left it, where a pass-2 chunk starting there begins.
+    std::vector<uint16_t> lineAddresses;
+    // Filled by the workers before pass 1 sweeps the lines: the "name:" label of each line
+    // and whether its size in lineSizes is already known.
+    std::vector<std::string_view> lineLabels;
+    std::vector<uint8_t> linePresized;
+    unsigned parallelism = 1;
+    bool annotateCycles = false;
+    // Chunk workers for large programs. A worker reads the line tables and symbols of
+    // `owner` (itself for an ordinary Assembler) and only keeps its own output and scratch
+    // state.
+    std::vector<std::unique_ptr<Assembler>> workers;
+    const Assembler* owner = this;
+
+    // Directive preprocessor (MACRO/ENDM, REPT/ENDR, IF/ELSE/ENDIF). Only runs when some
+    // input contains one of the keywords, so plain sources keep the fast include path.
+    bool preprocessorActive = false;
+    std::vector<uint8_t> lineKinds;
+    std::map<std::string_view, MacroDefinition, std::less<>> macros;
+    std::vector<Conditional> conditionals;
+    int captureDepth = 0;
+    int captureLine = 0;
+    MacroDefinition* captureMacro = nullptr;
+    int32_t repeatCount = 0;
+    std::vector<std::string_view> repeatBody;
+    uint32_t macroExpansions = 0;
+    int expansionDepth = 0;
+    std::string macroKey;
+    std::string substitutionBuffer;
+
+    // Relocatable object output.
+    bool objectMode = false;
+    uint16_t currentSection = 0;
+    std::vector<RelocationBase> relocationBases;
+    std::vector<Relocation> relocations;
+    std::vector<Export> exports;
+    // (first instruction entry, section) each time pass 2 enters a section.
+    std::vector<std::pair<uint32_t, uint16_t>> sectionChanges;
+    // Base of the value computed by the last evaluateExpression(), 0 if absolute, and the
+    // base of a relocatable value on the current line that no field has claimed yet.
+    uint16_t expressionBase = 0;
+    uint16_t pendingRelocation = 0;
+    uint16_t probeBase = 0;
+    uint16_t seenBases[4];
+    size_t seenBaseCount = 0;
+    size_t lineFirstByte = 0;
+    std::vector<std::string_view> fields;
+    std::vector<ImageSegment> image;
+    // One bit per address written by the image, filled while the image is built.
+    std::vector<uint64_t> occupancy;
+    std::vector<MemoryOverlap> overlaps;
+    // Entry that last wrote each address; only built once the first overlap shows up.
+    std::vector<uint32_t> writerOf;
+    // (first expanded line, include name) each time preprocessing enters or leaves a file.
+    std::vector<std::pair<uint32_t, std::string_view>> fileRuns;
+    std::string scratch;
+    std::string mnemonicBuffer;
+    std::string includeKey;
+    std::string symbolKey;
+    std::string expressionBuffer;
+    std::string hexOutput;
+
+    void pass1(const std::vector<std::string_view>& lines);
+    void resolvePendingEqus();
+    std::string unresolvedEquNote(std::string_view expression) const;
+    void pass2(const std::vector<std::string_view>& lines);
+    bool pass1Line(std::string_view rawLine, int lineNum, std::string& error);
+    bool widenOutOfRangeBranches();
+    bool flagsDeadAfter(size_t index);
+    void resetSections();
+    void switchSection(std::string_view name);
+    void declareExterns(std::string_view names);
+    void noteBase(uint16_t base);
+    void noteRelocation();
+    void checkExports(const std::vector<std::string_view>& lines);
+    std::string buildObject();
+    void writeHex();
+    void markOccupied(uint16_t address, uint32_t length, uint32_t entry, uint32_t first);
+    bool isCode(size_t entry) const;
+    uint32_t entryCycles(size_t entry) const;
+    void buildWriters(uint32_t entry, uint32_t marked);
+    void countRewrite(uint8_t oldOpcode, uint32_t oldLength, uint8_t newOpcode, uint32_t newLength);
+    size_t prepareWorkers(size_t lineCount, unsigned& threads);
+    bool presizeParallel(const std::vector<std::string_view>& lines);
+    bool presizeLine(size_t index, std::string_view& label, uint32_t& size);
+    int textSize(std::string_view mnemonic, std::string_view rest);
+    void pass2Range(const std::vector<std::string_view>& lines, size_t begin, size_t end);
+    bool pass2Parallel(const std::vector<std::string_view>& lines);
+    bool pass2Line(std::string_view rawLine, int lineNum, std::string& error);
+
+    // Remembers the code and offending text of the error being raised and returns `message`,
+    // so error sites read `error = diagnose(...)`.
+    std::string diagnose(const char* code, std::string_view token, std::string message);
+    void reportError(int lineNumber, std::string_view lineText, const std::string& message);
 
-    bool pass1(const std::vector<std::string>& lines, std::string& error);
-    bool pass2(const std::vector<std::string>& lines, std::string& error);
+    void preprocessIncludes(const std::vector<std::string_view>& lines, const std::vector<uint8_t>& marks,
+                            const std::vector<IncludeDirective>* directives, std::vector<std::string_view>& expanded);
+    const std::vector<IncludeDirective>* findIncludeDirectives(std::string_view file) const;
+    void emitLine(std::string_view line, LineKind kind, std::vector<std::string_view>& expanded);
+    void expandInclude(std::string_view line, std::vector<std::string_view>& expanded);
+    bool preprocessDirective(std::string_view line, std::vector<std::string_view>& expanded);
+    void replayLines(const std::vector<std::string_view>& body, const MacroDefinition* macro,
+                     const std::vector<std::string_view>& arguments, std::vector<std::string_view>& expanded);
+    std::string_view substituteParameters(std::string_view line, const MacroDefinition& macro,
+                                          const std::vector<std::string_view>& arguments, uint32_t expansion);
+    std::string_view lineText(size_t index) const;
+    std::string_view stripBlockComments(std::string_view line, bool& inBlockComment);
 
-    std::vector<std::string> preprocessIncludes(const std::vector<std::string>& lines, std::string& error,
-                                                std::vector<std::string>& includeStack) const;
-    std::string normalizeIncludeName(const std::string& includeToken) const;
+    Symbol& defineSymbol(std::string_view name);
+    const Symbol* findSymbol(std::string_view name);
 
-    int parseRegister(const std::string& token);
-    uint8_t getALUOpcode(const std::string& mnemonic, int ra, int rb);
+    int parseRegister(std::string_view token);
+    uint8_t getALUOpcode(std::string_view mnemonic, int ra, int rb);
 
-    void encodeLoadStore(const std::string& mnemonic, const std::string& op1, const std::string& op2,
+    void encodeLoadStore(std::string_view mnemonic, std::string_view op1, std::string_view op2,
                          std::vector<uint8_t>& bytes, int lineNum, std::string& error);
-    void encodeALU(const std::string& mnemonic, const std::string& op1, const std::string& op2,
+    void encodeALU(std::string_view mnemonic, std::string_view op1, std::string_view op2,
                    std::vector<uint8_t>& bytes, int lineNum, std::string& error);
-    void encodeBitOp(const std::string& mnemonic, const std::string& op1, const std::string& op2,
+    void encodeBitOp(std::string_view mnemonic, std::string_view op1, std::string_view op2,
                      std::vector<uint8_t>& bytes, int lineNum, std::string& error);
 
-    bool evaluateExpression(const std::string& expr, int32_t& result);
+    bool evaluateExpression(std::string_view expr, int32_t& result);
+    std::string expressionError() const;
     int32_t parseExpression(const char*& p);
     int32_t parseTerm(const char*& p);
     int32_t parseFactor(const char*& p);
 
-    std::map<std::string, uint8_t> opcodeMap;
+    std::map<std::string, uint8_t, std::less<>> opcodeMap;
     void initOpcodes();
 
-    void generateListingLine(const Instruction& inst);
+    void generateListingLine(size_t index);
 };
 
 #endif // ASSEMBLER_H
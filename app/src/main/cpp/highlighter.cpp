@@ -0,0 +1,152 @@
+#include "highlighter.h"
+#include "utils.h"
+
+#include <cctype>
+
+namespace {
+
+bool isWordStart(char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_'; }
+
+bool isWordChar(char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.'; }
+
+bool isRegisterName(std::string_view word) {
+    for (const char* name : {"R0", "R1", "R2", "R3", "SP", "PS"}) {
+        if (equalsIgnoreCase(word, name)) return true;
+    }
+    return false;
+}
+
+void addSpan(std::vector<int32_t>& spans, size_t offset, size_t length, TokenClass tokenClass) {
+    spans.push_back(static_cast<int32_t>(offset));
+    spans.push_back(static_cast<int32_t>(length));
+    spans.push_back(tokenClass);
+}
+
+} // namespace
+
+void SyntaxHighlighter::reset() {
+    lines.clear();
+}
+
+// Follows the assembler's own reading of a line: ';' and "//" end it even inside quotes,
+// "/* */" may span lines, and a label is the first word when a ':' follows it (or EQU does).
+void SyntaxHighlighter::lexLine(std::string_view line, bool inComment, Line& out) const {
+    out.spans.clear();
+    out.startsInComment = inComment;
+    size_t i = 0;
+    bool firstWord = true;
+    while (i < line.size()) {
+        const char c = line[i];
+        const char next = i + 1 < line.size() ? line[i + 1] : '\n';
+        if (inComment) {
+            const size_t close = line.find("*/", i);
+            const size_t end = close == std::string_view::npos ? line.size() : close + 2;
+            addSpan(out.spans, i, end - i, TOKEN_COMMENT);
+            inComment = close == std::string_view::npos;
+            i = end;
+        } else if (c == ';' || (c == '/' && next == '/')) {
+            addSpan(out.spans, i, line.size() - i, TOKEN_COMMENT);
+            break;
+        } else if (c == '/' && next == '*') {
+            const size_t close = line.find("*/", i + 2);
+            const size_t end = close == std::string_view::npos ? line.size() : close + 2;
+            addSpan(out.spans, i, end - i, TOKEN_COMMENT);
+            inComment = close == std::string_view::npos;
+            i = end;
+        } else if (c == '"' || c == '\'') {
+            size_t end = i + 1;
+            while (end < line.size() && line[end] != c && line[end] != ';') ++end;
+            if (end < line.size() && line[end] == c) ++end;
+            addSpan(out.spans, i, end - i, TOKEN_STRING);
+            i = end;
+        } else if (std::isdigit(static_cast<unsigned char>(c))) {
+            size_t end = i + 1;
+            while (end < line.size() && std::isalnum(static_cast<unsigned char>(line[end]))) ++end;
+            addSpan(out.spans, i, end - i, TOKEN_NUMBER);
+            i = end;
+        } else if (isWordStart(c)) {
+            size_t end = i + 1;
+            while (end < line.size() && isWordChar(line[end])) ++end;
+            const std::string_view word = line.substr(i, end - i);
+            size_t after = end;
+            while (after < line.size() && (line[after] == ' ' || line[after] == '\t')) ++after;
+            if (firstWord && after < line.size() && line[after] == ':') {
+                addSpan(out.spans, i, after + 1 - i, TOKEN_LABEL);
+                end = after + 1;
+            } else if (keywords.isMnemonic(word)) {
+                addSpan(out.spans, i, word.size(), TOKEN_MNEMONIC);
+            } else if (Assembler::isDirective(word)) {
+                addSpan(out.spans, i, word.size(), TOKEN_DIRECTIVE);
+            } else if (isRegisterName(word)) {
+                addSpan(out.spans, i, word.size(), TOKEN_REGISTER);
+            } else if (firstWord) {
+                std::string_view rest = line.substr(end);
+                if (equalsIgnoreCase(nextToken(rest), "EQU")) addSpan(out.spans, i, word.size(), TOKEN_LABEL);
+            }
+            firstWord = false;
+            i = end;
+        } else {
+            if (c != ' ' && c != '\t') firstWord = false;
+            ++i;
+        }
+    }
+    out.endsInComment = inComment;
+}
+
+void SyntaxHighlighter::splitLines(std::string_view text) {
+    lineText.clear();
+    for (size_t start = 0;;) {
+        const size_t end = text.find('\n', start);
+        lineText.push_back(text.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start));
+        if (end == std::string_view::npos) break;
+        start = end + 1;
+    }
+}
+
+const std::vector<int32_t>& SyntaxHighlighter::lexDocument(std::string_view text) {
+    splitLines(text);
+    lines.assign(lineText.size(), Line());
+    for (size_t i = 0; i < lineText.size(); ++i) lines[i].text.assign(lineText[i]);
+    return relex(0, lines.size());
+}
+
+const std::vector<int32_t>& SyntaxHighlighter::update(std::string_view editedLines, size_t firstLine,
+                                                      size_t removedLines, size_t addedLines) {
+    splitLines(editedLines);
+    if (lines.empty() || firstLine + removedLines >= lines.size() || lineText.size() != addedLines + 1) {
+        lines.clear();
+        result.clear();
+        return result;
+    }
+    lines.erase(lines.begin() + firstLine, lines.begin() + firstLine + removedLines + 1);
+    lines.insert(lines.begin() + firstLine, addedLines + 1, Line());
+    for (size_t i = 0; i <= addedLines; ++i) lines[firstLine + i].text.assign(lineText[i]);
+    return relex(firstLine, firstLine + addedLines + 1);
+}
+
+// Lexes the lines first..touchedEnd and, past them, stops at the first line whose cached
+// spans were lexed from the same block-comment state it would start in now.
+const std::vector<int32_t>& SyntaxHighlighter::relex(size_t first, size_t touchedEnd) {
+    const size_t count = lines.size();
+    size_t end = first;
+    for (; end < count; ++end) {
+        const bool inComment = end > 0 && lines[end - 1].endsInComment;
+        if (end >= touchedEnd && lines[end].startsInComment == inComment) break;
+        lexLine(lines[end].text, inComment, lines[end]);
+    }
+
+    result.clear();
+    result.push_back(static_cast<int32_t>(first));
+    result.push_back(static_cast<int32_t>(end - first));
+    int32_t lineStart = 0;
+    for (size_t i = first; i < end; ++i) {
+        const std::vector<int32_t>& spans = lines[i].spans;
+        for (size_t k = 0; k < spans.size(); k += 3) {
+            result.push_back(lineStart + spans[k]);
+            result.push_back(spans[k + 1]);
+            result.push_back(spans[k + 2]);
+        }
+        lineStart += static_cast<int32_t>(lines[i].text.size()) + 1;
+    }
+    return result;
+}
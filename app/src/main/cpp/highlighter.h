@@ -0,0 +1,61 @@
+#ifndef HIGHLIGHTER_H
+#define HIGHLIGHTER_H
+
+#include "assembler.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Span classes reported by SyntaxHighlighter. The values are shared with MainActivity
+// through JNI and must not be renumbered.
+enum TokenClass : int32_t {
+    TOKEN_MNEMONIC = 1,
+    TOKEN_DIRECTIVE = 2,
+    TOKEN_REGISTER = 3,
+    TOKEN_LABEL = 4,
+    TOKEN_NUMBER = 5,
+    TOKEN_COMMENT = 6,
+    TOKEN_STRING = 7
+};
+
+// Incremental lexer for the editor. It keeps the text and spans of every line of one
+// document so an edit only sends and re-lexes the lines it touched, plus any following
+// lines whose /* */ state the edit changed. Keywords come from the assembler itself, so the
+// highlighting never disagrees with what assembles.
+//
+// Both calls return {first line, line count, then offset, length, class for each span},
+// offsets counted from the start of the first line.
+class SyntaxHighlighter {
+public:
+    // Forgets the cached document and lexes every line of `text`.
+    const std::vector<int32_t>& lexDocument(std::string_view text);
+    // `editedLines` is the text of the new lines firstLine..firstLine+addedLines after an edit
+    // that replaced the old lines firstLine..firstLine+removedLines. If the edit does not fit
+    // the cached document (nothing cached, after reset(), or a range or line count that does
+    // not match) the cache is dropped and the result is empty: the caller then sends the
+    // whole document to lexDocument().
+    const std::vector<int32_t>& update(std::string_view editedLines, size_t firstLine, size_t removedLines,
+                                       size_t addedLines);
+    void reset();
+
+private:
+    struct Line {
+        std::string text;
+        std::vector<int32_t> spans; // offset within the line, length, class
+        bool startsInComment = false;
+        bool endsInComment = false;
+    };
+
+    void lexLine(std::string_view line, bool inComment, Line& out) const;
+    void splitLines(std::string_view text);
+    const std::vector<int32_t>& relex(size_t first, size_t touchedEnd);
+
+    Assembler keywords;
+    std::vector<Line> lines;
+    std::vector<std::string_view> lineText;
+    std::vector<int32_t> result;
+};
+
+#endif // HIGHLIGHTER_H
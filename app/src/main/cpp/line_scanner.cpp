@@ -0,0 +1,187 @@
+#include "line_scanner.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#define LINE_SCANNER_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LINE_SCANNER_NEON 1
+#endif
+
+namespace {
+
+const size_t kChunk = 64;
+
+// One bit per byte of a 64-byte chunk for each byte the scanner looks for.
+struct ChunkMasks {
+    uint64_t newline;
+    uint64_t semicolon;
+    uint64_t slash;
+    uint64_t colon;
+    uint64_t comma;
+};
+
+typedef void (*ClassifyChunk)(const char* chunk, ChunkMasks& masks);
+
+#if !defined(LINE_SCANNER_X86) && !defined(LINE_SCANNER_NEON)
+void classifyScalar(const char* chunk, ChunkMasks& masks) {
+    masks = ChunkMasks();
+    for (size_t i = 0; i < kChunk; ++i) {
+        const uint64_t bit = 1ULL << i;
+        switch (chunk[i]) {
+        case '\n': masks.newline |= bit; break;
+        case ';': masks.semicolon |= bit; break;
+        case '/': masks.slash |= bit; break;
+        case ':': masks.colon |= bit; break;
+        case ',': masks.comma |= bit; break;
+        default: break;
+        }
+    }
+}
+#endif
+
+#if defined(LINE_SCANNER_X86)
+uint64_t matchSse2(const __m128i blocks[4], char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        const uint32_t bits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(blocks[i], needle)));
+        mask |= static_cast<uint64_t>(bits) << (16 * i);
+    }
+    return mask;
+}
+
+void classifySse2(const char* chunk, ChunkMasks& masks) {
+    __m128i blocks[4];
+    for (int i = 0; i < 4; ++i) blocks[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(chunk + 16 * i));
+    masks.newline = matchSse2(blocks, '\n');
+    masks.semicolon = matchSse2(blocks, ';');
+    masks.slash = matchSse2(blocks, '/');
+    masks.colon = matchSse2(blocks, ':');
+    masks.comma = matchSse2(blocks, ',');
+}
+
+#if defined(__GNUC__)
+#define LINE_SCANNER_AVX2 1
+__attribute__((target("avx2"))) uint64_t matchAvx2(__m256i low, __m256i high, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    const uint32_t lowBits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, needle)));
+    const uint32_t highBits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, needle)));
+    return lowBits | (static_cast<uint64_t>(highBits) << 32);
+}
+
+__attribute__((target("avx2"))) void classifyAvx2(const char* chunk, ChunkMasks& masks) {
+    const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk));
+    const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk + 32));
+    masks.newline = matchAvx2(low, high, '\n');
+    masks.semicolon = matchAvx2(low, high, ';');
+    masks.slash = matchAvx2(low, high, '/');
+    masks.colon = matchAvx2(low, high, ':');
+    masks.comma = matchAvx2(low, high, ',');
+}
+#endif
+#endif
+
+#if defined(LINE_SCANNER_NEON)
+// NEON has no movemask: each matching byte keeps its bit weight (1, 2, ... 128 per half)
+// and pairwise adds fold the sixteen bytes into two mask bytes. vpadd_u8 exists on both
+// ARMv7 and AArch64.
+uint64_t matchNeon(const uint8x16_t blocks[4], uint8_t c) {
+    static const uint8_t kWeights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t weights = vld1q_u8(kWeights);
+    const uint8x16_t needle = vdupq_n_u8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        const uint8x16_t hits = vandq_u8(vceqq_u8(blocks[i], needle), weights);
+        uint8x8_t sum = vpadd_u8(vget_low_u8(hits), vget_high_u8(hits));
+        sum = vpadd_u8(sum, sum);
+        sum = vpadd_u8(sum, sum);
+        const uint64_t bits = vget_lane_u8(sum, 0) | (static_cast<uint64_t>(vget_lane_u8(sum, 1)) << 8);
+        mask |= bits << (16 * i);
+    }
+    return mask;
+}
+
+void classifyNeon(const char* chunk, ChunkMasks& masks) {
+    uint8x16_t blocks[4];
+    for (int i = 0; i < 4; ++i) blocks[i] = vld1q_u8(reinterpret_cast<const uint8_t*>(chunk) + 16 * i);
+    masks.newline = matchNeon(blocks, '\n');
+    masks.semicolon = matchNeon(blocks, ';');
+    masks.slash = matchNeon(blocks, '/');
+    masks.colon = matchNeon(blocks, ':');
+    masks.comma = matchNeon(blocks, ',');
+}
+#endif
+
+struct Classifier {
+    ClassifyChunk classify;
+    const char* kind;
+};
+
+Classifier pickClassifier() {
+#if defined(LINE_SCANNER_AVX2)
+    if (__builtin_cpu_supports("avx2")) return {classifyAvx2, "avx2"};
+#endif
+#if defined(LINE_SCANNER_X86)
+    return {classifySse2, "sse2"};
+#elif defined(LINE_SCANNER_NEON)
+    return {classifyNeon, "neon"};
+#else
+    return {classifyScalar, "scalar"};
+#endif
+}
+
+const Classifier& classifier() {
+    static const Classifier picked = pickClassifier();
+    return picked;
+}
+
+uint8_t marksIn(const ChunkMasks& masks, uint64_t range) {
+    return ((masks.semicolon & range) ? LINE_HAS_SEMICOLON : 0) | ((masks.slash & range) ? LINE_HAS_SLASH : 0) |
+           ((masks.colon & range) ? LINE_HAS_COLON : 0) | ((masks.comma & range) ? LINE_HAS_COMMA : 0);
+}
+
+} // namespace
+
+void scanLines(std::string_view text, std::vector<std::string_view>& lines, std::vector<uint8_t>& marks) {
+    lines.clear();
+    marks.clear();
+    if (text.empty()) return;
+
+    const ClassifyChunk classify = classifier().classify;
+    size_t start = 0;
+    uint8_t current = 0;
+    char tail[kChunk];
+    for (size_t base = 0; base < text.size(); base += kChunk) {
+        const char* chunk = text.data() + base;
+        if (text.size() - base < kChunk) {
+            // Zero padding matches nothing the scanner looks for.
+            std::memset(tail, 0, kChunk);
+            std::memcpy(tail, chunk, text.size() - base);
+            chunk = tail;
+        }
+        ChunkMasks masks;
+        classify(chunk, masks);
+
+        uint64_t consumed = 0;
+        for (uint64_t newlines = masks.newline; newlines != 0; newlines &= newlines - 1) {
+            const unsigned bit = static_cast<unsigned>(__builtin_ctzll(newlines));
+            const uint64_t upTo = bit == 63 ? ~0ULL : (2ULL << bit) - 1;
+            current |= marksIn(masks, upTo & ~consumed);
+            consumed = upTo;
+            const size_t end = base + bit;
+            lines.push_back(text.substr(start, end - start));
+            marks.push_back(current);
+            start = end + 1;
+            current = 0;
+        }
+        current |= marksIn(masks, ~consumed);
+    }
+    lines.push_back(text.substr(start));
+    marks.push_back(current);
+}
+
+const char* lineScannerKind() { return classifier().kind; }
@@ -0,0 +1,28 @@
+#ifndef LINE_SCANNER_H
+#define LINE_SCANNER_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Bytes a line may contain that the passes search for. A clear bit means the byte is
+// certainly absent, so the search can be skipped; a set bit only means it is present
+// somewhere in the line, possibly inside a comment or a string.
+enum LineMark : uint8_t {
+    LINE_HAS_SEMICOLON = 1,
+    LINE_HAS_SLASH = 2,
+    LINE_HAS_COLON = 4,
+    LINE_HAS_COMMA = 8,
+    LINE_HAS_ANY = 15
+};
+
+// Splits `text` at '\n' into the same lines as split(text, '\n') from utils.h, untrimmed
+// (an empty text has no lines and a trailing newline adds a final empty line), and records
+// the LineMark bits of each line. The buffer is classified 64 bytes at a time with SIMD compares where the CPU has
+// them, so one pass finds every newline and comment start. Both vectors are reused.
+void scanLines(std::string_view text, std::vector<std::string_view>& lines, std::vector<uint8_t>& marks);
+
+// "avx2", "sse2", "neon" or "scalar": the classifier picked for this CPU.
+const char* lineScannerKind();
+
+#endif // LINE_SCANNER_H
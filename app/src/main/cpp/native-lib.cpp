@@ -1,11 +1,18 @@
 #include <jni.h>
 #include <string>
 #include <map>
+#include <mutex>
 #include "assembler.h"
+#include "highlighter.h"
 #include "utils.h"
 
 static std::string lastListing = "";
+static std::string lastStats = "";
+static std::string lastDiagnostics = "[]";
 static std::map<std::string, std::string> gIncludeFiles;
+static std::mutex gHighlighterMutex;
+static SyntaxHighlighter gHighlighter;
+static std::string gHighlightText;
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_diamon_guia_NativeAssembler_registerIncludeFile(
@@ -39,6 +46,99 @@ Java_com_diamon_guia_NativeAssembler_getListing(
     return env->NewStringUTF(lastListing.c_str());
 }
 
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_diamon_guia_NativeAssembler_getStats(
+        JNIEnv* env,
+        jobject /* this */) {
+
+    return env->NewStringUTF(lastStats.c_str());
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_diamon_guia_NativeAssembler_getDiagnostics(
+        JNIEnv* env,
+        jobject /* this */) {
+
+    return env->NewStringUTF(lastDiagnostics.c_str());
+}
+
+// Copies `text` into gHighlightText, reused from call to call; gHighlighterMutex must be
+// held. Offsets must be UTF-16 indices for Java, so each UTF-16 unit becomes one byte; none
+// of the characters the lexer cares about is outside ASCII. Returns false, with the
+// OutOfMemoryError cleared, if the characters could not be copied out of the string.
+static bool copyHighlightText(JNIEnv* env, jstring text) {
+    const jsize length = env->GetStringLength(text);
+    const jchar* chars = env->GetStringChars(text, nullptr);
+    if (chars == nullptr) {
+        env->ExceptionClear();
+        return false;
+    }
+    gHighlightText.resize(static_cast<size_t>(length));
+    for (jsize i = 0; i < length; ++i) {
+        gHighlightText[i] = chars[i] < 0x80 ? static_cast<char>(chars[i]) : static_cast<char>(0x80);
+    }
+    env->ReleaseStringChars(text, chars);
+    return true;
+}
+
+static jintArray toIntArray(JNIEnv* env, const std::vector<int32_t>& spans) {
+    jintArray result = env->NewIntArray(static_cast<jsize>(spans.size()));
+    if (result != nullptr) {
+        env->SetIntArrayRegion(result, 0, static_cast<jsize>(spans.size()), reinterpret_cast<const jint*>(spans.data()));
+    }
+    return result;
+}
+
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_diamon_guia_NativeAssembler_highlightDocument(
+        JNIEnv* env,
+        jobject /* this */,
+        jstring text) {
+
+    if (text == nullptr) {
+        return env->NewIntArray(0);
+    }
+
+    std::lock_guard<std::mutex> lock(gHighlighterMutex);
+    if (!copyHighlightText(env, text)) {
+        gHighlighter.reset();
+        return env->NewIntArray(0);
+    }
+    return toIntArray(env, gHighlighter.lexDocument(gHighlightText));
+}
+
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_diamon_guia_NativeAssembler_highlightLines(
+        JNIEnv* env,
+        jobject /* this */,
+        jstring editedLines,
+        jint firstLine,
+        jint removedLines,
+        jint addedLines) {
+
+    if (editedLines == nullptr || firstLine < 0 || removedLines < 0 || addedLines < 0) {
+        return env->NewIntArray(0);
+    }
+
+    std::lock_guard<std::mutex> lock(gHighlighterMutex);
+    if (!copyHighlightText(env, editedLines)) {
+        gHighlighter.reset();
+        return env->NewIntArray(0);
+    }
+    return toIntArray(env, gHighlighter.update(gHighlightText, static_cast<size_t>(firstLine),
+                                               static_cast<size_t>(removedLines),
+                                               static_cast<size_t>(addedLines)));
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_diamon_guia_NativeAssembler_resetHighlighter(
+        JNIEnv* /* env */,
+        jobject /* this */) {
+
+    std::lock_guard<std::mutex> lock(gHighlighterMutex);
+    gHighlighter.reset();
+}
+
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_diamon_guia_NativeAssembler_assemble(
         JNIEnv* env,
@@ -63,6 +163,8 @@ Java_com_diamon_guia_NativeAssembler_assemble(
     std::string result = assembler.assemble(source);
 
     lastListing = assembler.getListing();
+    lastStats = statsToJson(assembler.getStats());
+    lastDiagnostics = diagnosticsToJson(assembler.getDiagnostics());
 
     if (result.find("ERROR") == 0) {
         LOGE("JNI: Assembly failed with result: %s", result.c_str());
@@ -1,6 +1,7 @@
 #include "utils.h"
 #include <sstream>
 #include <algorithm>
+#include <cctype>
 
 std::string trim(const std::string& str) {
     size_t first = str.find_first_not_of(" \t\r\n");
@@ -32,3 +33,86 @@ std::vector<std::string> split(const std::string& str, char delimiter) {
     }
     return tokens;
 }
+
+std::string_view trimView(std::string_view str) {
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (std::string_view::npos == first) {
+        return std::string_view();
+    }
+    size_t last = str.find_last_not_of(" \t\r\n");
+    return str.substr(first, (last - first + 1));
+}
+
+static char upperChar(char c) {
+    return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (upperChar(a[i]) != upperChar(b[i])) return false;
+    }
+    return true;
+}
+
+size_t findIgnoreCase(std::string_view haystack, std::string_view needle) {
+    if (needle.size() > haystack.size()) return std::string_view::npos;
+    for (size_t i = 0; i + needle.size() <= haystack.size(); ++i) {
+        if (equalsIgnoreCase(haystack.substr(i, needle.size()), needle)) return i;
+    }
+    return std::string_view::npos;
+}
+
+void toUpperInto(std::string_view str, std::string& out) {
+    out.assign(str.data(), str.size());
+    for (auto& c : out) c = upperChar(c);
+}
+
+std::string_view nextToken(std::string_view& rest) {
+    size_t start = 0;
+    while (start < rest.size() && isspace(static_cast<unsigned char>(rest[start]))) start++;
+    size_t end = start;
+    while (end < rest.size() && !isspace(static_cast<unsigned char>(rest[end]))) end++;
+    std::string_view token = rest.substr(start, end - start);
+    rest.remove_prefix(end);
+    return token;
+}
+
+size_t splitFields(std::string_view str, char delimiter, std::vector<std::string_view>& fields) {
+    fields.clear();
+    if (str.empty()) return 0;
+    size_t start = 0;
+    while (true) {
+        size_t pos = str.find(delimiter, start);
+        if (pos == std::string_view::npos) {
+            fields.push_back(trimView(str.substr(start)));
+            break;
+        }
+        fields.push_back(trimView(str.substr(start, pos - start)));
+        start = pos + 1;
+    }
+    return fields.size();
+}
+
+void appendJsonString(std::string& out, std::string_view text) {
+    static const char kHex[] = "0123456789abcdef";
+    out += '"';
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += kHex[(c >> 4) & 0x0F];
+                    out += kHex[c & 0x0F];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #ifdef __ANDROID__
@@ -18,4 +19,17 @@ std::string trim(const std::string& str);
 std::string toUpper(const std::string& str);
 std::vector<std::string> split(const std::string& str, char delimiter);
 
+// Allocation-free variants used on the assembler's hot paths. Views point into the input.
+std::string_view trimView(std::string_view str);
+bool equalsIgnoreCase(std::string_view a, std::string_view b);
+size_t findIgnoreCase(std::string_view haystack, std::string_view needle);
+void toUpperInto(std::string_view str, std::string& out);
+// Returns the next whitespace-delimited token and advances `rest` past it (like operator>>).
+std::string_view nextToken(std::string_view& rest);
+// Same fields as split(): trimmed, and a trailing delimiter yields a final empty field.
+size_t splitFields(std::string_view str, char delimiter, std::vector<std::string_view>& fields);
+// Appends `text` to `out` as a quoted JSON string; control characters become \n, \t, \r
+// or \u00XX escapes.
+void appendJsonString(std::string& out, std::string_view text);
+
 #endif // UTILS_H
@@ -42,6 +42,10 @@ import com.google.android.material.tabs.TabLayout;
 
 import androidx.activity.result.ActivityResultLauncher;
 import androidx.activity.result.contract.ActivityResultContracts;
+import org.json.JSONArray;
+import org.json.JSONException;
+import org.json.JSONObject;
+
 import java.io.InputStream;
 import java.io.BufferedReader;
 import java.io.InputStreamReader;
@@ -57,12 +61,9 @@ import java.nio.charset.StandardCharsets;
 import java.util.Locale;
 import java.util.Collections;
 import java.util.LinkedHashMap;
-import java.util.List;
 import java.util.Map;
 import java.util.concurrent.ExecutorService;
 import java.util.concurrent.Executors;
-import java.util.regex.Matcher;
-import java.util.regex.Pattern;
 
 public class MainActivity extends AppCompatActivity {
 
@@ -86,10 +87,14 @@ public class MainActivity extends AppCompatActivity {
     private String lastGeneratedHex = "";
     private String lastGeneratedList = "";
 
-    // Optimizaciones de Resaltado
-    private final Handler syntaxHandler = new Handler(Looper.getMainLooper());
-    private Runnable syntaxRunnable;
-    private static final long HIGHLIGHT_DELAY = 300; // ms
+    // Resaltado incremental: la edición en curso, en líneas, tal como la ven los callbacks
+    // del TextWatcher antes y después del cambio.
+    private int editFirstLine;
+    private int editRemovedLines;
+    private int editAddedLines;
+    // Caracteres de las líneas nuevas de la edición, del inicio de la primera al final de la última.
+    private int editRangeStart;
+    private int editRangeEnd;
 
     private final ActivityResultLauncher<String[]> openFileLauncher = registerForActivityResult(
             new ActivityResultContracts.OpenDocument(),
@@ -99,13 +104,6 @@ public class MainActivity extends AppCompatActivity {
                 }
             });
 
-    private static final Pattern PATTERN_MNEMONIC = Pattern.compile(
-            "(?i)\\b(MOVE|AND|XOR|OR|ADD|SUB|CMP|LD|ST|BCC|BCS|BNE|BEQ|BVC|BVS|BPL|BMI|BGE|BLT|BGT|BLE|BUC|BUS|BHI|BLS|JMP|JSR|POP|PUSH|RET|RETI|TRAP|NOP|SXT|ABS|INV|NEG|CLR|INC|DEC|ADDQ|TEST|R0|R1|R2|R3|SP|PS|PC)\\b");
-    private static final Pattern PATTERN_DIRECTIVE = Pattern.compile("(?i)\\b(ORG|EQU|DB|DW|DL|DM|DS|INCLUDE)\\b");
-    private static final Pattern PATTERN_LABEL = Pattern.compile("(?m)^\\s*[A-Za-z_][A-Za-z0-9_]*:");
-    private static final Pattern PATTERN_NUMBER = Pattern.compile("\\b(0x[0-9A-Fa-f]+|\\d+)\\b");
-    private static final Pattern PATTERN_COMMENT = Pattern.compile("(;.*$|//.*$)");
-
     @Override
     protected void onCreate(Bundle savedInstanceState) {
         super.onCreate(savedInstanceState);
@@ -359,9 +357,10 @@ public class MainActivity extends AppCompatActivity {
                 final String result = assembler.assemble(source);
 
                 if (result.startsWith("ERROR")) {
+                    final String errors = formatDiagnostics(assembler.getDiagnostics(), result);
                     mainHandler.post(() -> {
                         setStatus(getString(R.string.status_failed), true);
-                        showErrorDialog(result);
+                        showErrorDialog(errors);
                     });
                 } else {
                     lastGeneratedHex = result;
@@ -470,9 +469,40 @@ public class MainActivity extends AppCompatActivity {
         // Actualizar números de línea tras el cambio
         updateLineNumbers();
 
-        // Solo resaltar si no estaba cacheado o si es texto plano
+        // Solo resaltar si no estaba cacheado o si es texto plano; en ambos casos el
+        // resaltador nativo pasa a recordar este documento.
         if (!isAlreadyHighlighted && content != null && content.length() > 0) {
             applySyntaxHighlightingToEditor();
+        } else {
+            assembler.resetHighlighter();
+            final String textStr = etSource.getText().toString();
+            executorService.execute(() -> assembler.highlightDocument(textStr));
+        }
+    }
+
+    // Un error por línea ("Línea N:C [código] mensaje"); si el JSON no se puede leer se
+    // muestra el resultado original del ensamblador.
+    private String formatDiagnostics(String diagnosticsJson, String fallback) {
+        try {
+            JSONArray diagnostics = new JSONArray(diagnosticsJson);
+            if (diagnostics.length() == 0) {
+                return fallback;
+            }
+            StringBuilder sb = new StringBuilder();
+            for (int i = 0; i < diagnostics.length(); i++) {
+                JSONObject d = diagnostics.getJSONObject(i);
+                if (i > 0) {
+                    sb.append('\n');
+                }
+                sb.append("Línea ").append(d.optInt("line"));
+                if (d.optInt("column") > 0) {
+                    sb.append(':').append(d.optInt("column"));
+                }
+                sb.append(" [").append(d.optString("code")).append("] ").append(d.optString("message"));
+            }
+            return sb.toString();
+        } catch (JSONException e) {
+            return fallback;
         }
     }
 
@@ -556,22 +586,43 @@ public class MainActivity extends AppCompatActivity {
         etSource.addTextChangedListener(new TextWatcher() {
             @Override
             public void beforeTextChanged(CharSequence s, int start, int count, int after) {
+                editFirstLine = countNewlines(s, 0, start);
+                editRemovedLines = countNewlines(s, start, start + count);
             }
 
             @Override
             public void onTextChanged(CharSequence s, int start, int before, int count) {
+                editAddedLines = countNewlines(s, start, start + count);
+                editRangeStart = start;
+                while (editRangeStart > 0 && s.charAt(editRangeStart - 1) != '\n') {
+                    editRangeStart--;
+                }
+                editRangeEnd = start + count;
+                while (editRangeEnd < s.length() && s.charAt(editRangeEnd) != '\n') {
+                    editRangeEnd++;
+                }
             }
 
             @Override
             public void afterTextChanged(Editable editable) {
                 if (!isTabSwitching) {
                     updateLineNumbers();
-                    scheduleSyntaxHighlighting();
+                    highlightEditedLines(editable);
                 }
             }
         });
     }
 
+    private static int countNewlines(CharSequence s, int start, int end) {
+        int lines = 0;
+        for (int i = start; i < end; i++) {
+            if (s.charAt(i) == '\n') {
+                lines++;
+            }
+        }
+        return lines;
+    }
+
     private void updateLineNumbers() {
         if (etSource == null || tvLineNumbers == null)
             return;
@@ -597,12 +648,32 @@ public class MainActivity extends AppCompatActivity {
         tvLineNumbers.setText(sb.toString());
     }
 
-    private void scheduleSyntaxHighlighting() {
-        if (syntaxRunnable != null) {
-            syntaxHandler.removeCallbacks(syntaxRunnable);
+    // Vuelve a colorear solo las líneas que la biblioteca nativa reanalizó tras la edición; a
+    // la biblioteca solo se le envían las líneas editadas. Si no recuerda este documento
+    // (por ejemplo mientras se resalta entero en segundo plano), se resalta todo.
+    private void highlightEditedLines(Editable editable) {
+        int[] tokens = assembler.highlightLines(editable.subSequence(editRangeStart, editRangeEnd).toString(),
+                editFirstLine, editRemovedLines, editAddedLines);
+        if (tokens.length == 0) {
+            applySyntaxHighlightingToEditor();
+            return;
         }
-        syntaxRunnable = this::applySyntaxHighlightingToEditor;
-        syntaxHandler.postDelayed(syntaxRunnable, HIGHLIGHT_DELAY);
+        if (tokens.length < 2 || tokens[1] == 0)
+            return;
+
+        // La primera línea devuelta es siempre la primera de la edición.
+        int rangeStart = editRangeStart;
+        int rangeEnd = rangeStart;
+        for (int line = 0; rangeEnd < editable.length(); rangeEnd++) {
+            if (editable.charAt(rangeEnd) == '\n' && ++line == tokens[1]) {
+                break;
+            }
+        }
+
+        for (ForegroundColorSpan span : editable.getSpans(rangeStart, rangeEnd, ForegroundColorSpan.class)) {
+            editable.removeSpan(span);
+        }
+        applyTokenSpans(editable, rangeStart, tokens);
     }
 
     private void applySyntaxHighlightingToEditor() {
@@ -618,64 +689,70 @@ public class MainActivity extends AppCompatActivity {
         final int cursorEnd = etSource.getSelectionEnd();
 
         isApplyingSyntaxHighlight = true;
-
-        // Colores para el resaltado
-        final int colorMnemonic = ContextCompat.getColor(this, R.color.syntax_mnemonic);
-        final int colorDirective = ContextCompat.getColor(this, R.color.syntax_directive);
-        final int colorLabel = ContextCompat.getColor(this, R.color.syntax_label);
-        final int colorNumber = ContextCompat.getColor(this, R.color.syntax_number);
-        final int colorComment = ContextCompat.getColor(this, R.color.syntax_comment);
+        assembler.resetHighlighter();
 
         executorService.execute(() -> {
-            try {
-                // Crear un borrador con los colores aplicados en segundo plano
-                final SpannableStringBuilder ssb = new SpannableStringBuilder(textStr);
-
-                applyColorToBuilder(ssb, PATTERN_MNEMONIC, colorMnemonic);
-                applyColorToBuilder(ssb, PATTERN_DIRECTIVE, colorDirective);
-                applyColorToBuilder(ssb, PATTERN_LABEL, colorLabel);
-                applyColorToBuilder(ssb, PATTERN_NUMBER, colorNumber);
-                applyColorToBuilder(ssb, PATTERN_COMMENT, colorComment);
+            // El análisis nativo de todo el documento es rápido; el coste está en crear los
+            // spans, así que se aplican en segundo plano sobre un borrador.
+            final SpannableStringBuilder ssb = new SpannableStringBuilder(textStr);
+            applyTokenSpans(ssb, 0, assembler.highlightDocument(textStr));
 
-                mainHandler.post(() -> {
-                    // Verificar si el texto ha cambiado mientras procesábamos
-                    if (etSource == null || !etSource.getText().toString().equals(textStr))
-                        return;
-
-                    isTabSwitching = true; // Bloquear TextWatcher durante el reemplazo atómico
-                    etSource.setText(ssb);
-                    // Restaurar cursor
-                    if (cursorStart >= 0 && cursorEnd >= 0 && cursorEnd <= ssb.length()) {
-                        etSource.setSelection(cursorStart, cursorEnd);
-                    }
-                    isTabSwitching = false;
-                });
-            } finally {
+            mainHandler.post(() -> {
                 isApplyingSyntaxHighlight = false;
-            }
-        });
-    }
-
-    private void applyColorToBuilder(SpannableStringBuilder ssb, Pattern pattern, int color) {
-        Matcher matcher = pattern.matcher(ssb.toString());
-        while (matcher.find()) {
-            ssb.setSpan(new ForegroundColorSpan(color), matcher.start(), matcher.end(),
-                    Spannable.SPAN_EXCLUSIVE_EXCLUSIVE);
-        }
-    }
+                if (etSource == null)
+                    return;
+                // Si el texto cambió mientras procesábamos, esas ediciones se resaltaron
+                // contra otro documento: se vuelve a empezar con el texto actual.
+                if (!etSource.getText().toString().equals(textStr)) {
+                    applySyntaxHighlightingToEditor();
+                    return;
+                }
 
-    // Ya no lo usamos con el nuevo enfoque atómico
-    private void collectSpans(String text, Pattern pattern, int color, List<SpanRange> out) {
+                isTabSwitching = true; // Bloquear TextWatcher durante el reemplazo atómico
+                etSource.setText(ssb);
+                // Restaurar cursor
+                if (cursorStart >= 0 && cursorEnd >= 0 && cursorEnd <= ssb.length()) {
+                    etSource.setSelection(cursorStart, cursorEnd);
+                }
+                isTabSwitching = false;
+            });
+        });
     }
 
-    // Ya no lo usamos con el nuevo enfoque atómico
-    private static class SpanRange {
-        int start, end, color;
+    // tokens = {primeraLínea, líneas, inicio, longitud, clase, ...} con inicios relativos a `base`.
+    private void applyTokenSpans(Spannable target, int base, int[] tokens) {
+        final int colorMnemonic = ContextCompat.getColor(this, R.color.syntax_mnemonic);
+        final int colorDirective = ContextCompat.getColor(this, R.color.syntax_directive);
+        final int colorLabel = ContextCompat.getColor(this, R.color.syntax_label);
+        final int colorNumber = ContextCompat.getColor(this, R.color.syntax_number);
+        final int colorComment = ContextCompat.getColor(this, R.color.syntax_comment);
 
-        SpanRange(int start, int end, int color) {
-            this.start = start;
-            this.end = end;
-            this.color = color;
+        for (int i = 2; i + 2 < tokens.length; i += 3) {
+            int color;
+            switch (tokens[i + 2]) {
+                case NativeAssembler.TOKEN_MNEMONIC:
+                case NativeAssembler.TOKEN_REGISTER:
+                    color = colorMnemonic;
+                    break;
+                case NativeAssembler.TOKEN_DIRECTIVE:
+                    color = colorDirective;
+                    break;
+                case NativeAssembler.TOKEN_LABEL:
+                    color = colorLabel;
+                    break;
+                case NativeAssembler.TOKEN_NUMBER:
+                case NativeAssembler.TOKEN_STRING:
+                    color = colorNumber;
+                    break;
+                default:
+                    color = colorComment;
+                    break;
+            }
+            int start = base + tokens[i];
+            int end = Math.min(start + tokens[i + 1], target.length());
+            if (start < end) {
+                target.setSpan(new ForegroundColorSpan(color), start, end, Spannable.SPAN_EXCLUSIVE_EXCLUSIVE);
+            }
         }
     }
 
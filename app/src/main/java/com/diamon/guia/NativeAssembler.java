@@ -16,5 +16,51 @@ public class NativeAssembler {
 
     public native String getListing();
 
+    /**
+     * Devuelve las estadísticas de la última llamada a {@link #assemble(String)} como JSON:
+     * tiempos por fase, líneas, símbolos, bytes emitidos y expresiones evaluadas.
+     */
+    public native String getStats();
+
+    /**
+     * Devuelve todos los errores de la última llamada a {@link #assemble(String)} como un
+     * arreglo JSON de objetos {@code {"line", "column", "code", "message"}}. Está vacío si el
+     * ensamblado tuvo éxito.
+     */
+    public native String getDiagnostics();
+
     public native void registerIncludeFile(String includeName, String includeContent);
+
+    /** Clases de token que devuelve {@link #highlightLines}. */
+    public static final int TOKEN_MNEMONIC = 1;
+    public static final int TOKEN_DIRECTIVE = 2;
+    public static final int TOKEN_REGISTER = 3;
+    public static final int TOKEN_LABEL = 4;
+    public static final int TOKEN_NUMBER = 5;
+    public static final int TOKEN_COMMENT = 6;
+    public static final int TOKEN_STRING = 7;
+
+    /**
+     * Olvida el documento recordado y analiza {@code text} entero.
+     *
+     * @return {@code {0, cantidadDeLíneas, inicio, longitud, clase, ...}}, con los inicios
+     *         contados desde el comienzo del documento.
+     */
+    public native int[] highlightDocument(String text);
+
+    /**
+     * Resalta el documento recordado tras una edición que reemplazó las líneas
+     * {@code firstLine..firstLine+removedLines} por {@code firstLine..firstLine+addedLines};
+     * {@code editedLines} es solo el texto de esas líneas nuevas. Solo se vuelven a analizar
+     * las líneas tocadas (y las siguientes si abrió o cerró un comentario de bloque).
+     *
+     * @return {@code {primeraLínea, cantidadDeLíneas, inicio, longitud, clase, ...}}, con los
+     *         inicios contados desde el comienzo de la primera línea devuelta, o un arreglo
+     *         vacío si la edición no encaja con el documento recordado (por ejemplo tras
+     *         {@link #resetHighlighter()}): entonces hay que llamar a {@link #highlightDocument}.
+     */
+    public native int[] highlightLines(String editedLines, int firstLine, int removedLines, int addedLines);
+
+    /** Olvida el documento recordado por {@link #highlightDocument}; llamar al cambiar de pestaña. */
+    public native void resetHighlighter();
 }
@@ -79,9 +79,11 @@ int main(int argc, char** argv) {
 CPP
 
 cli_bin="${workdir}/assembler_cli"
-g++ -std=c++17 -O2 -I"${workdir}" -I"${ROOT_DIR}/app/src/main/cpp" \
+g++ -std=c++17 -O2 -pthread -I"${workdir}" -I"${ROOT_DIR}/app/src/main/cpp" \
   "${workdir}/assembler_cli.cpp" \
   "${ROOT_DIR}/app/src/main/cpp/assembler.cpp" \
+  "${ROOT_DIR}/app/src/main/cpp/line_scanner.cpp" \
+  "${ROOT_DIR}/app/src/main/cpp/arena.cpp" \
   "${ROOT_DIR}/app/src/main/cpp/utils.cpp" \
   -o "${cli_bin}"
 
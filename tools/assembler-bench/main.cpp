@@ -0,0 +1,634 @@
+#include "assembler.h"
+#include "allocation_counter.h"
+#include "line_scanner.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct GeneratedProgram {
+    std::string name;
+    std::string source;
+    std::map<std::string, std::string> includes;
+    size_t totalLines = 0;
+};
+
+// Genera programas sintéticos que ensamblan sin errores: bloques de código con
+// saltos cortos dentro del bloque, llamadas a subrutinas de bibliotecas incluidas,
+// cadenas de EQU profundas (y algunas con referencias hacia adelante) y datos.
+class ProgramGenerator {
+public:
+    ProgramGenerator(size_t targetLines, uint32_t seed) : rng(seed), targetLines(targetLines) {}
+
+    GeneratedProgram generate() {
+        emit(program.source, "// Programa sintético generado por assembler-bench");
+        emit(program.source, "        org     0x0000");
+
+        while (emittedLines < targetLines) {
+            if (blockCount % kBlocksPerLibrary == 0) {
+                relocateIfNeeded();
+                emitLibrary();
+            }
+            relocateIfNeeded();
+            if (blockCount % 8 == 7) {
+                emitData();
+            } else {
+                emitCodeBlock();
+            }
+            ++blockCount;
+        }
+
+        program.totalLines = emittedLines;
+        return std::move(program);
+    }
+
+private:
+    static constexpr int kBlocksPerLibrary = 64;
+    static constexpr int kChainDepth = 32;
+    static constexpr int kReverseChainDepth = 8;
+    static constexpr int kSubroutinesPerLibrary = 4;
+    static constexpr int kVariablesPerLibrary = 8;
+
+    std::mt19937 rng;
+    size_t targetLines;
+    size_t emittedLines = 0;
+    uint32_t address = 0;
+    int blockCount = 0;
+    int libraryCount = 0;
+    std::vector<std::string> constants;
+    std::vector<std::string> variables;
+    std::vector<std::string> subroutines;
+    std::vector<std::string> codeLabels;
+    GeneratedProgram program;
+
+    void emit(std::string& out, const std::string& line) {
+        out += line;
+        out += '\n';
+        ++emittedLines;
+    }
+
+    int pick(int n) {
+        return std::uniform_int_distribution<int>(0, n - 1)(rng);
+    }
+
+    std::string reg() {
+        return "r" + std::to_string(pick(4));
+    }
+
+    template <typename T>
+    const T& pickFrom(const std::vector<T>& items) {
+        return items[static_cast<size_t>(pick(static_cast<int>(items.size())))];
+    }
+
+    void relocateIfNeeded() {
+        // El espacio de direcciones es de 64 KiB: se vuelve a empezar con ORG antes de desbordar.
+        if (address > 0xF000) {
+            emit(program.source, "        org     0x0100");
+            address = 0x0100;
+        }
+    }
+
+    std::string immediateExpression() {
+        if (!constants.empty() && pick(3) == 0) {
+            return pickFrom(constants) + (pick(2) ? "+" + std::to_string(pick(16)) : "*2");
+        }
+        return pick(2) ? "0x" + std::to_string(1000 + pick(8000)) : std::to_string(pick(256));
+    }
+
+    // Devuelve una instrucción con su tamaño en bytes, según la mezcla típica de los ejemplos.
+    std::string instruction(const std::string& blockLabel, const std::string& endLabel, int& size) {
+        const int kind = pick(20);
+        const std::string r = reg();
+        switch (kind) {
+            case 0:
+                size = 3;
+                return "ld.w    " + r + ",#" + immediateExpression();
+            case 1:
+                size = 2;
+                return "ld.b    " + r + ",#" + std::to_string(pick(256));
+            case 2:
+                size = 1;
+                return "ld.w    " + std::string(pick(2) ? "r0" : "r1") + ",(r" + std::to_string(2 + pick(2)) + ")";
+            case 3:
+                size = 1;
+                return "ld.b    " + std::string(pick(2) ? "r0" : "r1") + ",(r" + std::to_string(2 + pick(2)) + "++)";
+            case 4:
+                size = 2;
+                return "ld.w    " + r + ",(sp+" + std::to_string(2 * pick(8)) + ")";
+            case 5:
+                if (variables.empty()) break;
+                size = 3;
+                return "ld.w    " + r + "," + pickFrom(variables);
+            case 6:
+                if (variables.empty()) break;
+                size = 3;
+                return "st.w    " + pickFrom(variables) + "," + r;
+            case 7:
+                size = 1;
+                return "st.b    (r" + std::to_string(2 + pick(2)) + ")," + std::string(pick(2) ? "r0" : "r1");
+            case 8: {
+                static const char* const kAluOps[] = {"move", "add", "sub", "and", "or", "xor", "cmp"};
+                size = 1;
+                return std::string(kAluOps[pick(7)]) + "     " + r + "," + reg();
+            }
+            case 9: {
+                static const char* const kUnaryOps[] = {"inc", "dec", "clr", "test", "neg", "inv"};
+                size = 1;
+                return std::string(kUnaryOps[pick(6)]) + "     " + r;
+            }
+            case 10:
+                size = 1;
+                return "addq    " + r + ",#" + (pick(2) ? "1" : "-2");
+            case 11: {
+                static const char* const kShiftOps[] = {"lsl", "lsr", "asl", "asr", "rol", "ror"};
+                size = 2;
+                return std::string(kShiftOps[pick(6)]) + "     " + r + ",#" + std::to_string(1 + pick(7));
+            }
+            case 12: {
+                static const char* const kBitOps[] = {"btst", "bset", "bclr", "bchg"};
+                size = 2;
+                return std::string(kBitOps[pick(4)]) + "    " + r + ",#" + std::to_string(pick(16));
+            }
+            case 13:
+                size = 1;
+                return std::string(pick(2) ? "push" : "pop ") + "    " + r;
+            case 14:
+                if (subroutines.empty()) break;
+                size = 3;
+                return "jsr     " + pickFrom(subroutines);
+            case 15:
+                if (codeLabels.empty()) break;
+                size = 3;
+                return "jmp     " + pickFrom(codeLabels);
+            case 16: {
+                static const char* const kBranches[] = {"bne", "beq", "bcc", "bcs", "bpl", "bmi", "bge", "blt"};
+                size = 2;
+                return std::string(kBranches[pick(8)]) + "     " + blockLabel;
+            }
+            case 17: {
+                static const char* const kBranches[] = {"bne", "beq", "bhi", "bls", "bgt", "ble", "buc"};
+                size = 2;
+                return std::string(kBranches[pick(7)]) + "     " + endLabel;
+            }
+            default:
+                break;
+        }
+        size = 1;
+        return "move    " + r + "," + reg();
+    }
+
+    void emitCodeBlock() {
+        const std::string label = "L" + std::to_string(blockCount);
+        const std::string endLabel = label + "E";
+        std::string& out = program.source;
+
+        emit(out, label + ":");
+        const int count = 6 + pick(11);
+        for (int i = 0; i < count; ++i) {
+            int size = 0;
+            std::string line = "        " + instruction(label, endLabel, size);
+            const int decoration = pick(10);
+            if (decoration == 0) line += ";   // " + std::to_string(address);
+            else if (decoration == 1) line += "; comentario";
+            emit(out, line);
+            address += static_cast<uint32_t>(size);
+        }
+        if (pick(6) == 0) {
+            emit(out, "/* comentario de bloque");
+            emit(out, "   de varias lineas */");
+        }
+        emit(out, endLabel + ":");
+        emit(out, "");
+        codeLabels.push_back(label);
+    }
+
+    void emitData() {
+        std::string& out = program.source;
+        const std::string label = "T" + std::to_string(blockCount);
+        switch (pick(4)) {
+            case 0:
+                emit(out, label + ":  db  1,2,3,4,5,6,7,8");
+                address += 8;
+                break;
+            case 1:
+                emit(out, label + ":  dw  0x1234," + (codeLabels.empty() ? std::string("0") : pickFrom(codeLabels)));
+                address += 4;
+                break;
+            case 2:
+                emit(out, label + ":  dm  \"megaprocessor\"");
+                address += 14;
+                break;
+            default:
+                emit(out, label + ":  ds  16");
+                address += 16;
+                break;
+        }
+    }
+
+    void emitLibrary() {
+        const int lib = libraryCount++;
+        const std::string id = std::to_string(lib);
+        const std::string constsName = "consts_" + id + ".inc";
+        const std::string libName = "lib_" + id + ".inc";
+
+        std::string consts;
+        emit(consts, "// Constantes de la biblioteca " + id);
+        emit(consts, "K" + id + "_0 equ 0x10+" + id);
+        for (int j = 1; j < kChainDepth; ++j) {
+            emit(consts, "K" + id + "_" + std::to_string(j) + " equ K" + id + "_" + std::to_string(j - 1) + "+3");
+        }
+        // Cadena declarada al revés: fuerza la resolución diferida de EQU.
+        for (int j = 0; j < kReverseChainDepth - 1; ++j) {
+            emit(consts, "R" + id + "_" + std::to_string(j) + " equ R" + id + "_" + std::to_string(j + 1) + "+1");
+        }
+        emit(consts, "R" + id + "_" + std::to_string(kReverseChainDepth - 1) + " equ 5");
+        program.includes[constsName] = consts;
+
+        std::string library;
+        emit(library, "// Biblioteca sintética " + id);
+        emit(library, "include \"" + constsName + "\";");
+        for (int s = 0; s < kSubroutinesPerLibrary; ++s) {
+            const std::string sub = "S" + id + "_" + std::to_string(s);
+            const std::string endLabel = sub + "E";
+            emit(library, sub + ":");
+            const int count = 3 + pick(6);
+            for (int i = 0; i < count; ++i) {
+                int size = 0;
+                emit(library, "        " + instruction(sub, endLabel, size));
+                address += static_cast<uint32_t>(size);
+            }
+            emit(library, endLabel + ":");
+            emit(library, "        ret");
+            address += 1;
+            subroutines.push_back(sub);
+        }
+        for (int v = 0; v < kVariablesPerLibrary; ++v) {
+            const std::string var = "V" + id + "_" + std::to_string(v);
+            emit(library, var + ":  dw  0");
+            address += 2;
+            variables.push_back(var);
+        }
+        program.includes[libName] = library;
+
+        emit(program.source, "include \"" + libName + "\";");
+        for (int j = 0; j < kChainDepth; j += 7) {
+            constants.push_back("K" + id + "_" + std::to_string(j));
+        }
+        constants.push_back("R" + id + "_0");
+    }
+};
+
+struct RunResult {
+    std::string name;
+    size_t lines = 0;
+    AssemblyStats stats{};
+    double totalMs = 0.0;
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+    long peakRssKb = 0;
+    size_t hexBytes = 0;
+    size_t listingBytes = 0;
+    // 1 si el HEX coincide con el de referencia, 0 si no, -1 si no había referencia.
+    int matchesReference = -1;
+};
+
+long peakRssKb() {
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+RunResult runOnce(Assembler& assembler, const GeneratedProgram& program, const std::string* reference) {
+    RunResult result;
+    result.name = program.name;
+    result.lines = program.totalLines;
+
+    const uint64_t allocationsBefore = allocationCount();
+    const uint64_t bytesBefore = allocatedBytes();
+    const Clock::time_point start = Clock::now();
+
+    assembler.setIncludeFiles(program.includes);
+    const std::string hex = assembler.assemble(program.source);
+    const std::string listing = assembler.getListing();
+
+    result.totalMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    result.allocations = allocationCount() - allocationsBefore;
+    result.allocatedBytes = allocatedBytes() - bytesBefore;
+    result.peakRssKb = peakRssKb();
+
+    if (hex.rfind("ERROR:", 0) == 0) {
+        throw std::runtime_error("El programa " + (program.name.empty() ? std::string("sintético") : program.name) +
+                                 " no ensambla: " + hex);
+    }
+    if (reference) result.matchesReference = hex == *reference ? 1 : 0;
+
+    result.stats = assembler.getStats();
+    result.hexBytes = hex.size();
+    result.listingBytes = listing.size();
+    return result;
+}
+
+std::string readText(const fs::path& path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("No se pudo leer: " + path.string());
+    }
+    std::stringstream buffer;
+    buffer << input.rdbuf();
+    return buffer.str();
+}
+
+// Carga cada .asm del directorio como programa; los demás .asm quedan disponibles como
+// includes, igual que en el repositorio (Megaprocessor_defs.asm).
+std::vector<GeneratedProgram> loadCorpus(const fs::path& dir) {
+    std::vector<fs::path> paths;
+    for (const fs::directory_entry& entry : fs::directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".asm") paths.push_back(entry.path());
+    }
+    if (paths.empty()) {
+        throw std::runtime_error("No hay archivos .asm en: " + dir.string());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::map<std::string, std::string> files;
+    for (const fs::path& path : paths) files[path.filename().string()] = readText(path);
+
+    std::vector<GeneratedProgram> programs;
+    for (const auto& file : files) {
+        GeneratedProgram program;
+        program.name = file.first;
+        program.source = file.second;
+        program.totalLines = static_cast<size_t>(std::count(program.source.begin(), program.source.end(), '\n')) + 1;
+        for (const auto& other : files) {
+            if (other.first != file.first) program.includes[other.first] = other.second;
+        }
+        programs.push_back(std::move(program));
+    }
+    return programs;
+}
+
+// Busca en el historial la última medición del mismo programa (o tamaño sintético).
+// El historial son líneas JSON escritas por appendHistory(), así que basta con buscar claves.
+bool previousTotalMs(const std::vector<std::string>& history, const std::string& key, double& totalMs) {
+    for (auto line = history.rbegin(); line != history.rend(); ++line) {
+        if (line->find("\"program\":\"" + key + "\"") == std::string::npos) continue;
+        const size_t pos = line->find("\"total_ms\":");
+        if (pos == std::string::npos) continue;
+        totalMs = std::stod(line->substr(pos + 11));
+        return true;
+    }
+    return false;
+}
+
+// Añade una línea por resultado al historial y avisa en stderr de lo que empeoró más que
+// `threshold` (en %) respecto a la medición anterior del mismo programa.
+int appendHistory(const fs::path& path, const std::vector<RunResult>& results, unsigned threads, double threshold) {
+    std::vector<std::string> history;
+    {
+        std::ifstream input(path);
+        for (std::string line; std::getline(input, line);) {
+            if (!line.empty()) history.push_back(line);
+        }
+    }
+
+    char date[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    std::ofstream output(path, std::ios::app);
+    if (!output) {
+        throw std::runtime_error("No se pudo escribir: " + path.string());
+    }
+    int regressions = 0;
+    for (const RunResult& r : results) {
+        const std::string key = r.name.empty() ? "synthetic_" + std::to_string(r.lines) : r.name;
+        double previousMs = 0.0;
+        if (previousTotalMs(history, key, previousMs) && previousMs > 0.0) {
+            const double change = (r.totalMs - previousMs) / previousMs * 100.0;
+            if (change > threshold) {
+                std::fprintf(stderr, "Regresión en %s: %.3f ms frente a %.3f ms (+%.1f%%)\n", key.c_str(), r.totalMs,
+                             previousMs, change);
+                ++regressions;
+            }
+        }
+        char line[512];
+        std::snprintf(line, sizeof(line),
+                      "{\"date\":\"%s\",\"program\":\"%s\",\"lines\":%zu,\"total_ms\":%.3f,\"scanner\":\"%s\",\"threads\":%u,"
+                      "\"allocations\":%llu,\"peak_rss_kb\":%ld}",
+                      date, key.c_str(), r.lines, r.totalMs, lineScannerKind(), threads,
+                      static_cast<unsigned long long>(r.allocations), r.peakRssKb);
+        output << line << '\n';
+    }
+    return regressions;
+}
+
+void writeProgram(const fs::path& dir, const GeneratedProgram& program) {
+    fs::create_directories(dir);
+    auto writeText = [](const fs::path& path, const std::string& text) {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        if (!output) {
+            throw std::runtime_error("No se pudo escribir: " + path.string());
+        }
+        output << text;
+    };
+    writeText(dir / ("synthetic_" + std::to_string(program.totalLines) + ".asm"), program.source);
+    for (const auto& entry : program.includes) {
+        writeText(dir / entry.first, entry.second);
+    }
+}
+
+void printTableHeader(bool named) {
+    if (named) std::printf("%-20s ", "program");
+    std::printf("%10s %10s %10s %10s %10s %10s %10s %12s %12s %10s %10s\n",
+                "lines", "total_ms", "preproc", "pass1", "pass2", "hex", "listing",
+                "lines/s", "allocs", "alloc_MiB", "rss_MiB");
+}
+
+void printTableRow(const RunResult& r, bool named) {
+    const double linesPerSecond = r.totalMs > 0.0 ? r.lines / (r.totalMs / 1000.0) : 0.0;
+    if (named) std::printf("%-20s ", r.name.c_str());
+    std::printf("%10zu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %12.0f %12llu %10.1f %10.1f\n",
+                r.lines, r.totalMs, r.stats.preprocessMs, r.stats.pass1Ms, r.stats.pass2Ms,
+                r.stats.hexMs, r.stats.listingMs, linesPerSecond,
+                static_cast<unsigned long long>(r.allocations),
+                r.allocatedBytes / (1024.0 * 1024.0), r.peakRssKb / 1024.0);
+    if (r.matchesReference == 0) std::printf("  HEX distinto de la referencia\n");
+}
+
+void printJson(const std::vector<RunResult>& results) {
+    std::printf("[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const RunResult& r = results[i];
+        const double linesPerSecond = r.totalMs > 0.0 ? r.lines / (r.totalMs / 1000.0) : 0.0;
+        std::printf("  {");
+        if (!r.name.empty()) std::printf("\"program\": \"%s\", ", r.name.c_str());
+        if (r.matchesReference >= 0) std::printf("\"matches_reference\": %s, ", r.matchesReference ? "true" : "false");
+        std::printf("\"lines\": %zu, \"total_ms\": %.3f, \"preprocess_ms\": %.3f, \"pass1_ms\": %.3f, "
+                    "\"pass2_ms\": %.3f, \"hex_ms\": %.3f, \"listing_ms\": %.3f, \"lines_per_sec\": %.0f, "
+                    "\"allocations\": %llu, \"allocated_bytes\": %llu, \"peak_rss_kb\": %ld, "
+                    "\"hex_bytes\": %zu, \"listing_bytes\": %zu}%s\n",
+                    r.lines, r.totalMs, r.stats.preprocessMs, r.stats.pass1Ms, r.stats.pass2Ms,
+                    r.stats.hexMs, r.stats.listingMs, linesPerSecond,
+                    static_cast<unsigned long long>(r.allocations),
+                    static_cast<unsigned long long>(r.allocatedBytes), r.peakRssKb,
+                    r.hexBytes, r.listingBytes, i + 1 < results.size() ? "," : "");
+    }
+    std::printf("]\n");
+}
+
+void printUsage(const char* programName) {
+    std::cerr << "Uso: " << programName
+              << " [--lines <n>]... [--repeat <n>] [--reuse] [--threads <n>] [--seed <n>] [--json] [--emit-dir <directorio>]\n"
+              << "       " << programName
+              << " --corpus <directorio> [--reference-dir <directorio>] [--repeat <n>] [--reuse] [--threads <n>] [--json]\n"
+              << "       (con cualquiera de los dos modos) [--history <archivo.jsonl>] [--max-regression <porcentaje>]\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        std::vector<size_t> sizes;
+        int repeat = 1;
+        uint32_t seed = 12345;
+        bool json = false;
+        bool reuse = false;
+        unsigned threads = 1;
+        fs::path emitDir;
+        fs::path corpusDir;
+        fs::path referenceDir;
+        fs::path historyPath;
+        double maxRegression = 20.0;
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--lines" && i + 1 < argc) {
+                sizes.push_back(static_cast<size_t>(std::stoull(argv[++i])));
+                continue;
+            }
+            if (arg == "--repeat" && i + 1 < argc) {
+                repeat = std::max(1, std::stoi(argv[++i]));
+                continue;
+            }
+            if (arg == "--seed" && i + 1 < argc) {
+                seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+                continue;
+            }
+            if (arg == "--reuse") {
+                reuse = true;
+                continue;
+            }
+            if (arg == "--threads" && i + 1 < argc) {
+                threads = static_cast<unsigned>(std::max(0, std::stoi(argv[++i])));
+                continue;
+            }
+            if (arg == "--json") {
+                json = true;
+                continue;
+            }
+            if (arg == "--emit-dir" && i + 1 < argc) {
+                emitDir = argv[++i];
+                continue;
+            }
+            if (arg == "--corpus" && i + 1 < argc) {
+                corpusDir = argv[++i];
+                continue;
+            }
+            if (arg == "--reference-dir" && i + 1 < argc) {
+                referenceDir = argv[++i];
+                continue;
+            }
+            if (arg == "--history" && i + 1 < argc) {
+                historyPath = argv[++i];
+                continue;
+            }
+            if (arg == "--max-regression" && i + 1 < argc) {
+                maxRegression = std::stod(argv[++i]);
+                continue;
+            }
+            std::cerr << "Argumento no reconocido: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        // Con --corpus se miden los programas reales del directorio en lugar de los sintéticos.
+        std::vector<GeneratedProgram> corpus;
+        if (!corpusDir.empty()) {
+            corpus = loadCorpus(corpusDir);
+        } else if (sizes.empty()) {
+            sizes = {10000, 100000, 1000000};
+        }
+        const bool named = !corpus.empty();
+        const size_t runs = named ? corpus.size() : sizes.size();
+
+        std::vector<RunResult> results;
+        // Va a stderr para no romper la tabla ni el JSON de stdout.
+        std::cerr << "Escáner de líneas: " << lineScannerKind() << "\n";
+        if (!json) {
+            printTableHeader(named);
+        }
+        int mismatches = 0;
+        for (size_t run = 0; run < runs; ++run) {
+            const GeneratedProgram program = named ? std::move(corpus[run]) : ProgramGenerator(sizes[run], seed).generate();
+            if (!emitDir.empty() && !named) {
+                writeProgram(emitDir, program);
+            }
+            std::string reference;
+            const fs::path referencePath = referenceDir / fs::path(program.name).replace_extension(".hex");
+            const bool hasReference = named && !referenceDir.empty() && fs::exists(referencePath);
+            if (hasReference) reference = readText(referencePath);
+
+            // Se conserva la repetición más rápida; el pico de RSS es del proceso completo.
+            // Con --reuse todas las repeticiones comparten el mismo Assembler, de modo que
+            // a partir de la segunda se mide el estado estable (arena y buffers ya reservados).
+            RunResult best;
+            Assembler shared;
+            shared.setParallelism(threads);
+            for (int r = 0; r < repeat; ++r) {
+                Assembler fresh;
+                fresh.setParallelism(threads);
+                RunResult current = runOnce(reuse ? shared : fresh, program, hasReference ? &reference : nullptr);
+                if (r == 0 || current.totalMs < best.totalMs) {
+                    best = current;
+                }
+            }
+            if (best.matchesReference == 0) ++mismatches;
+            results.push_back(best);
+            if (!json) {
+                printTableRow(best, named);
+                std::fflush(stdout);
+            }
+        }
+
+        if (json) {
+            printJson(results);
+        }
+        int regressions = 0;
+        if (!historyPath.empty()) {
+            regressions = appendHistory(historyPath, results, threads, maxRegression);
+        }
+        return mismatches > 0 || regressions > 0 ? 2 : 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Fallo: " << ex.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,110 @@
+#include "build_cache.h"
+#include "mapped_file.h"
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Cambiar al modificar el formato de las entradas. Los cambios en la salida del ensamblador
+// ya los cubre buildIdentity().
+const char kCacheFormat[] = "megaprocessor-asm-cache-2";
+
+const uint64_t kFnvOffset = 1469598103934665603ULL;
+const uint64_t kFnvPrime = 1099511628211ULL;
+
+void hashBytes(uint64_t& hash, std::string_view bytes) {
+    for (unsigned char c : bytes) {
+        hash ^= c;
+        hash *= kFnvPrime;
+    }
+}
+
+// Separa cada campo con su longitud para que ("ab", "c") y ("a", "bc") no colisionen.
+void hashField(uint64_t& hash, std::string_view field) {
+    const std::string length = std::to_string(field.size()) + ":";
+    hashBytes(hash, length);
+    hashBytes(hash, field);
+}
+
+// Identifica el ejecutable que ensambla: ruta, tamaño y fecha de modificación. Un ensamblador
+// recompilado (aunque nadie cambie kCacheFormat) no reutiliza entradas de uno anterior.
+std::string buildIdentity() {
+    std::error_code ec;
+    const fs::path executable = fs::read_symlink("/proc/self/exe", ec);
+    if (ec) return std::string();
+    const uintmax_t size = fs::file_size(executable, ec);
+    if (ec) return std::string();
+    const fs::file_time_type modified = fs::last_write_time(executable, ec);
+    if (ec) return std::string();
+    return executable.string() + ";" + std::to_string(size) + ";" + std::to_string(modified.time_since_epoch().count());
+}
+
+bool readEntry(const fs::path& path, std::string& content) {
+    std::error_code ec;
+    if (!fs::is_regular_file(path, ec)) {
+        return false;
+    }
+    const MappedFile mapped(path);
+    content.assign(mapped.view());
+    return true;
+}
+
+void writeEntry(const fs::path& path, const std::string& content) {
+    const fs::path temporary = path.string() + ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+        if (!output) {
+            throw std::runtime_error("No se pudo escribir en la caché: " + temporary.string());
+        }
+        output << content;
+    }
+    fs::rename(temporary, path);
+}
+
+} // namespace
+
+BuildCache::BuildCache(fs::path directory) : directory(std::move(directory)) {
+    fs::create_directories(this->directory);
+}
+
+std::string BuildCache::computeKey(std::string_view source, const std::map<std::string, std::string_view>& includes,
+                                   std::string_view options) {
+    uint64_t hash = kFnvOffset;
+    static const std::string identity = buildIdentity();
+    hashField(hash, kCacheFormat);
+    hashField(hash, identity);
+    hashField(hash, options);
+    hashField(hash, source);
+    for (const auto& entry : includes) {
+        hashField(hash, entry.first);
+        hashField(hash, entry.second);
+    }
+
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
+}
+
+bool BuildCache::load(const std::string& key, CachedBuild& build) const {
+    return readEntry(directory / (key + ".hex"), build.hex) &&
+           readEntry(directory / (key + ".lst"), build.listing) &&
+           readEntry(directory / (key + ".sym"), build.symbols) &&
+           readEntry(directory / (key + ".warn"), build.warnings) &&
+           readEntry(directory / (key + ".opt"), build.optimizerSummary);
+}
+
+void BuildCache::store(const std::string& key, const CachedBuild& build) const {
+    // El .hex se escribe al final: load() exige los cinco archivos.
+    writeEntry(directory / (key + ".lst"), build.listing);
+    writeEntry(directory / (key + ".sym"), build.symbols);
+    writeEntry(directory / (key + ".warn"), build.warnings);
+    writeEntry(directory / (key + ".opt"), build.optimizerSummary);
+    writeEntry(directory / (key + ".hex"), build.hex);
+}
@@ -0,0 +1,42 @@
+#ifndef BUILD_CACHE_H
+#define BUILD_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+
+// Resultado de un ensamblado exitoso tal como se guarda en la caché.
+struct CachedBuild {
+    std::string hex;
+    std::string listing;
+    std::string symbols;
+    // Avisos ya formateados, vacío si no hubo.
+    std::string warnings;
+    // Resumen de --optimize ya formateado, vacío sin esa opción.
+    std::string optimizerSummary;
+};
+
+// Caché en disco de ensamblados. La clave es un hash FNV-1a de 64 bits del fuente, del
+// nombre y contenido de cada include alcanzable, de las opciones que cambian la salida, de
+// la versión del formato y del ejecutable del ensamblador, así que cualquier cambio en un
+// archivo del grafo o un ensamblador recompilado invalida la entrada.
+class BuildCache {
+public:
+    explicit BuildCache(std::filesystem::path directory);
+
+    static std::string computeKey(std::string_view source, const std::map<std::string, std::string_view>& includes,
+                                  std::string_view options);
+
+    // Devuelve false si no hay entrada completa para `key`.
+    bool load(const std::string& key, CachedBuild& build) const;
+    // Escribe cada archivo a un temporal y lo renombra, para que otro proceso nunca lea
+    // una entrada a medio escribir.
+    void store(const std::string& key, const CachedBuild& build) const;
+
+private:
+    std::filesystem::path directory;
+};
+
+#endif // BUILD_CACHE_H
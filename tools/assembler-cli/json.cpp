@@ -0,0 +1,225 @@
+#include "json.h"
+
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+class JsonParser {
+public:
+    explicit JsonParser(std::string_view text) : text(text), pos(0) {}
+
+    void parseDocument(JsonValue& value) {
+        parseValue(value, 0);
+        skipWhitespace();
+        if (pos != text.size()) fail("texto sobrante después del valor");
+    }
+
+private:
+    // Límite de anidamiento para que una petición maliciosa no agote la pila.
+    static const int kMaxDepth = 64;
+
+    std::string_view text;
+    size_t pos;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error(message + " (posición " + std::to_string(pos) + ")");
+    }
+
+    void skipWhitespace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+            ++pos;
+        }
+    }
+
+    bool consumeLiteral(std::string_view literal) {
+        if (text.substr(pos, literal.size()) != literal) return false;
+        pos += literal.size();
+        return true;
+    }
+
+    void parseValue(JsonValue& value, int depth) {
+        if (depth > kMaxDepth) fail("anidamiento demasiado profundo");
+        skipWhitespace();
+        if (pos >= text.size()) fail("fin inesperado");
+
+        const size_t start = pos;
+        const char c = text[pos];
+        if (c == '{') {
+            value.type = JsonValue::OBJECT;
+            parseObject(value, depth);
+        } else if (c == '[') {
+            value.type = JsonValue::ARRAY;
+            parseArray(value, depth);
+        } else if (c == '"') {
+            value.type = JsonValue::STRING;
+            parseString(value.string);
+        } else if (consumeLiteral("true")) {
+            value.type = JsonValue::BOOLEAN;
+            value.boolean = true;
+        } else if (consumeLiteral("false")) {
+            value.type = JsonValue::BOOLEAN;
+            value.boolean = false;
+        } else if (consumeLiteral("null")) {
+            value.type = JsonValue::NUL;
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            value.type = JsonValue::NUMBER;
+            parseNumber(value.number);
+        } else {
+            fail(std::string("carácter inesperado '") + c + "'");
+        }
+        value.raw = text.substr(start, pos - start);
+    }
+
+    void parseObject(JsonValue& value, int depth) {
+        ++pos;
+        skipWhitespace();
+        if (pos < text.size() && text[pos] == '}') {
+            ++pos;
+            return;
+        }
+        while (true) {
+            skipWhitespace();
+            if (pos >= text.size() || text[pos] != '"') fail("se esperaba una clave");
+            std::string key;
+            parseString(key);
+            skipWhitespace();
+            if (pos >= text.size() || text[pos] != ':') fail("se esperaba ':'");
+            ++pos;
+            parseValue(value.members[key], depth + 1);
+            skipWhitespace();
+            if (pos < text.size() && text[pos] == ',') {
+                ++pos;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == '}') {
+                ++pos;
+                return;
+            }
+            fail("se esperaba ',' o '}'");
+        }
+    }
+
+    void parseArray(JsonValue& value, int depth) {
+        ++pos;
+        skipWhitespace();
+        if (pos < text.size() && text[pos] == ']') {
+            ++pos;
+            return;
+        }
+        while (true) {
+            value.items.emplace_back();
+            parseValue(value.items.back(), depth + 1);
+            skipWhitespace();
+            if (pos < text.size() && text[pos] == ',') {
+                ++pos;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == ']') {
+                ++pos;
+                return;
+            }
+            fail("se esperaba ',' o ']'");
+        }
+    }
+
+    unsigned parseHex4() {
+        if (pos + 4 > text.size()) fail("escape \\u incompleto");
+        unsigned code = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char h = text[pos++];
+            code <<= 4;
+            if (h >= '0' && h <= '9') code |= h - '0';
+            else if (h >= 'a' && h <= 'f') code |= h - 'a' + 10;
+            else if (h >= 'A' && h <= 'F') code |= h - 'A' + 10;
+            else fail("escape \\u inválido");
+        }
+        return code;
+    }
+
+    static void appendUtf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    void parseString(std::string& out) {
+        ++pos;
+        while (true) {
+            if (pos >= text.size()) fail("cadena sin cerrar");
+            const char c = text[pos++];
+            if (c == '"') return;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= text.size()) fail("escape incompleto");
+            const char e = text[pos++];
+            switch (e) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned code = parseHex4();
+                    if (code >= 0xD800 && code <= 0xDBFF && text.substr(pos, 2) == "\\u") {
+                        pos += 2;
+                        const unsigned low = parseHex4();
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(out, code);
+                    break;
+                }
+                default: fail("escape desconocido");
+            }
+        }
+    }
+
+    void parseNumber(double& number) {
+        const size_t start = pos;
+        if (text[pos] == '-') ++pos;
+        while (pos < text.size() && ((text[pos] >= '0' && text[pos] <= '9') || text[pos] == '.' ||
+                                     text[pos] == 'e' || text[pos] == 'E' || text[pos] == '+' || text[pos] == '-')) {
+            ++pos;
+        }
+        const std::string digits(text.substr(start, pos - start));
+        char* end = nullptr;
+        number = std::strtod(digits.c_str(), &end);
+        if (end != digits.c_str() + digits.size()) fail("número inválido");
+    }
+};
+
+} // namespace
+
+const JsonValue* JsonValue::find(const std::string& key) const {
+    if (type != OBJECT) return nullptr;
+    auto it = members.find(key);
+    return it == members.end() ? nullptr : &it->second;
+}
+
+bool parseJson(std::string_view text, JsonValue& value, std::string& error) {
+    try {
+        value = JsonValue();
+        JsonParser(text).parseDocument(value);
+        return true;
+    } catch (const std::exception& ex) {
+        error = ex.what();
+        return false;
+    }
+}
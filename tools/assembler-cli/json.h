@@ -0,0 +1,37 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lector JSON mínimo para el protocolo de --serve. Cada valor conserva además el texto
+// exacto del que salió (`raw`), lo que permite devolver el "id" de la petición tal cual.
+struct JsonValue {
+    enum Type {
+        NUL,
+        BOOLEAN,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT
+    };
+
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> items;
+    std::map<std::string, JsonValue> members;
+    std::string_view raw;
+
+    // Miembro de un objeto, o nullptr si no existe o el valor no es un objeto.
+    const JsonValue* find(const std::string& key) const;
+};
+
+// Devuelve false y describe el problema en `error` si `text` no es un único valor JSON válido.
+// Los `raw` del resultado apuntan dentro de `text`.
+bool parseJson(std::string_view text, JsonValue& value, std::string& error);
+
+#endif // JSON_H
@@ -1,33 +1,26 @@
 #include "assembler.h"
+#include "allocation_counter.h"
+#include "build_cache.h"
+#include "project_loader.h"
+#include "server.h"
 
 #include <algorithm>
-#include <cctype>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
-#include <regex>
-#include <set>
-#include <sstream>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 namespace fs = std::filesystem;
 
 namespace {
 
-std::string readFile(const fs::path& filePath) {
-    std::ifstream input(filePath, std::ios::binary);
-    if (!input) {
-        throw std::runtime_error("No se pudo abrir: " + filePath.string());
-    }
-
-    std::ostringstream buffer;
-    buffer << input.rdbuf();
-    return buffer.str();
-}
-
 void writeFile(const fs::path& filePath, const std::string& content) {
     std::ofstream output(filePath, std::ios::binary | std::ios::trunc);
     if (!output) {
@@ -36,73 +29,131 @@ void writeFile(const fs::path& filePath, const std::string& content) {
     output << content;
 }
 
-std::string normalizeIncludeToken(std::string token) {
-    token.erase(std::remove(token.begin(), token.end(), '"'), token.end());
-    token.erase(std::remove(token.begin(), token.end(), '\''), token.end());
-    token.erase(std::remove(token.begin(), token.end(), ';'), token.end());
+// Escapa una ruta para una regla de make: espacios, '#' y '$' tienen significado especial.
+std::string escapeMakePath(const std::string& path) {
+    std::string escaped;
+    for (char c : path) {
+        if (c == ' ' || c == '#') {
+            escaped += '\\';
+        } else if (c == '$') {
+            escaped += '$';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
 
-    while (!token.empty() && std::isspace(static_cast<unsigned char>(token.back()))) {
-        token.pop_back();
+// Escribe un depfile al estilo de `gcc -MD`: los archivos generados dependen del fuente y de
+// todos los includes alcanzables, y cada include aparece además como regla vacía para que make
+// no falle si se borra.
+void writeDepfile(const fs::path& depfilePath, const std::vector<fs::path>& targets, const std::vector<fs::path>& dependencies) {
+    std::string rule;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        rule += (i == 0 ? "" : " ") + escapeMakePath(fs::absolute(targets[i]).string());
+    }
+    rule += ':';
+    for (const auto& dependency : dependencies) {
+        rule += " \\\n  " + escapeMakePath(dependency.string());
     }
-    while (!token.empty() && std::isspace(static_cast<unsigned char>(token.front()))) {
-        token.erase(token.begin());
+    rule += '\n';
+    for (size_t i = 1; i < dependencies.size(); ++i) {
+        rule += '\n' + escapeMakePath(dependencies[i].string()) + ":\n";
     }
+    writeFile(depfilePath, rule);
+}
 
-    return token;
+std::string formatDiagnostics(const char* title, const std::vector<Diagnostic>& diagnostics) {
+    std::string out = std::string(title) + " (" + std::to_string(diagnostics.size()) + "):\n";
+    for (const Diagnostic& d : diagnostics) {
+        out += "  línea " + std::to_string(d.line);
+        if (d.column > 0) {
+            out += ", columna " + std::to_string(d.column);
+        }
+        out += " [" + d.code + "] " + d.message + "\n";
+    }
+    return out;
 }
 
-fs::path resolveIncludePath(const std::string& includeName, const fs::path& asmDir, const fs::path& projectRoot) {
-    const fs::path includePath(includeName);
+void printDiagnostics(const char* title, const std::vector<Diagnostic>& diagnostics) {
+    std::cerr << formatDiagnostics(title, diagnostics);
+}
 
-    std::vector<fs::path> candidates = {
-        asmDir / includePath,
-        projectRoot / includePath,
-        projectRoot / "app" / "src" / "main" / "assets" / includePath,
-    };
+void printStats(const AssemblyStats& stats) {
+    std::printf("Estadísticas:\n");
+    std::printf("  preprocessIncludes     %10.3f ms\n", stats.preprocessMs);
+    std::printf("  pass1                  %10.3f ms\n", stats.pass1Ms);
+    std::printf("  pass2                  %10.3f ms\n", stats.pass2Ms);
+    std::printf("  HEX                    %10.3f ms\n", stats.hexMs);
+    std::printf("  listado                %10.3f ms\n", stats.listingMs);
+    std::printf("  líneas fuente          %10zu\n", stats.sourceLines);
+    std::printf("  líneas expandidas      %10zu\n", stats.expandedLines);
+    std::printf("  includes expandidos    %10zu\n", stats.includesExpanded);
+    std::printf("  símbolos               %10zu\n", stats.symbolCount);
+    std::printf("  bytes emitidos         %10zu\n", stats.bytesEmitted);
+    std::printf("  expresiones evaluadas  %10llu\n", static_cast<unsigned long long>(stats.expressionEvaluations));
+    std::printf("  asignaciones de heap   %10llu\n", static_cast<unsigned long long>(stats.allocations));
+    std::printf("  saltos ampliados       %10zu\n", stats.branchesRelaxed);
+    std::printf("  rondas de relajación   %10zu\n", stats.relaxationPasses);
+    std::printf("  reescrituras peephole  %10zu\n", stats.peepholeRewrites);
+}
 
-    for (const auto& candidate : candidates) {
-        if (fs::exists(candidate) && fs::is_regular_file(candidate)) {
-            return fs::canonical(candidate);
-        }
-    }
+std::string hexWord(uint32_t value) {
+    char text[8];
+    std::snprintf(text, sizeof(text), "%04X", static_cast<unsigned int>(value & 0xFFFF));
+    return text;
+}
 
-    throw std::runtime_error("Include no encontrado: " + includeName);
+std::string rangeText(uint32_t start, uint32_t length) {
+    return hexWord(start) + "-" + hexWord(start + length - 1);
 }
 
-void loadIncludeRecursive(const fs::path& includeFile,
-                         const fs::path& projectRoot,
-                         std::map<std::string, std::string>& includeFiles,
-                         std::set<std::string>& visited) {
-    const std::string canonical = fs::canonical(includeFile).string();
-    if (!visited.insert(canonical).second) {
-        return;
+// Informe legible del mapa de memoria: regiones, huecos libres, subrutinas más grandes y
+// bytes por archivo.
+std::string formatMemoryMap(const MemoryMap& map) {
+    const size_t kLargest = 10;
+    std::string out = "Memoria usada: " + std::to_string(map.usedBytes) + " de 65536 bytes\n\nRegiones:\n";
+    for (const MemoryRange& range : map.regions) {
+        out += "  " + rangeText(range.start, range.length) + "  " + std::to_string(range.length) + " bytes\n";
+    }
+    out += "\nHuecos libres:\n";
+    for (const MemoryRange& range : map.gaps) {
+        out += "  " + rangeText(range.start, range.length) + "  " + std::to_string(range.length) + " bytes\n";
     }
 
-    const std::string content = readFile(includeFile);
-    includeFiles[includeFile.filename().string()] = content;
-
-    static const std::regex includeRegex(R"(^\s*include\s+([^\s]+))", std::regex::icase);
-    std::istringstream stream(content);
-    std::string line;
+    std::vector<LabelExtent> largest = map.labels;
+    std::stable_sort(largest.begin(), largest.end(), [](const LabelExtent& a, const LabelExtent& b) { return a.bytes > b.bytes; });
+    if (largest.size() > kLargest) largest.resize(kLargest);
+    out += "\nEtiquetas más grandes:\n";
+    for (const LabelExtent& label : largest) {
+        if (label.bytes == 0) break;
+        out += "  " + rangeText(label.address, label.bytes) + "  " + std::to_string(label.bytes) + " bytes  " + label.name + "\n";
+    }
 
-    while (std::getline(stream, line)) {
-        std::smatch match;
-        if (!std::regex_search(line, match, includeRegex)) {
-            continue;
-        }
+    out += "\nBytes por archivo:\n";
+    for (const FileUsage& file : map.files) {
+        out += "  " + std::to_string(file.bytes) + "\t" + (file.file.empty() ? "(fuente principal)" : file.file) + "\n";
+    }
 
-        const std::string includeName = normalizeIncludeToken(match[1].str());
-        if (includeName.empty()) {
-            continue;
+    if (!map.overlaps.empty()) {
+        out += "\nSolapamientos:\n";
+        for (const MemoryOverlap& overlap : map.overlaps) {
+            out += "  " + rangeText(overlap.address, overlap.length) + "  línea " + std::to_string(overlap.secondLine) +
+                   " sobrescribe a la línea " + std::to_string(overlap.firstLine) + "\n";
         }
+    }
 
-        const fs::path nestedInclude = resolveIncludePath(includeName, includeFile.parent_path(), projectRoot);
-        loadIncludeRecursive(nestedInclude, projectRoot, includeFiles, visited);
+    out += "\nEtiquetas:\n";
+    for (const LabelExtent& label : map.labels) {
+        out += "  " + hexWord(label.address) + "  " + std::to_string(label.bytes) + "\t" + label.name + "\n";
     }
+    return out;
 }
 
 void printUsage(const char* programName) {
-    std::cerr << "Uso: " << programName << " <archivo.asm> [--lst] [--out <archivo.hex>] [--lst-out <archivo.lst>]\n";
+    std::cerr << "Uso: " << programName << " <archivo.asm> [--lst] [--out <archivo.hex>] [--lst-out <archivo.lst>]"
+              << " [--sym-out <archivo.sym>] [--stats] [--relax] [--optimize] [--obj] [--threads <n>] [--map-out <archivo.map>] [--map-json <archivo.json>]"
+              << " [--cycles] [--cycles-json <archivo.json>] [--line-map <archivo.json>] [--cache-dir <directorio>] [--depfile <archivo.d>]\n"
+              << "       " << programName << " --serve [--socket <ruta>] [--workers <n>]\n";
 }
 
 } // namespace
@@ -117,7 +168,23 @@ int main(int argc, char* argv[]) {
         fs::path asmPath;
         fs::path hexOutputPath;
         fs::path lstOutputPath;
+        fs::path symOutputPath;
+        fs::path cacheDir;
+        fs::path depfilePath;
+        fs::path mapOutputPath;
+        fs::path mapJsonPath;
+        fs::path cyclesJsonPath;
+        fs::path lineMapPath;
+        fs::path socketPath;
         bool writeListing = false;
+        bool showStats = false;
+        bool relaxBranches = false;
+        bool optimize = false;
+        bool objectOutput = false;
+        bool annotateCycles = false;
+        bool serve = false;
+        size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        unsigned threads = 1;
 
         for (int i = 1; i < argc; ++i) {
             const std::string arg = argv[i];
@@ -125,6 +192,26 @@ int main(int argc, char* argv[]) {
                 writeListing = true;
                 continue;
             }
+            if (arg == "--stats") {
+                showStats = true;
+                continue;
+            }
+            if (arg == "--relax") {
+                relaxBranches = true;
+                continue;
+            }
+            if (arg == "--optimize") {
+                optimize = true;
+                continue;
+            }
+            if (arg == "--obj") {
+                objectOutput = true;
+                continue;
+            }
+            if (arg == "--cycles") {
+                annotateCycles = true;
+                continue;
+            }
             if (arg == "--out" && i + 1 < argc) {
                 hexOutputPath = argv[++i];
                 continue;
@@ -134,6 +221,50 @@ int main(int argc, char* argv[]) {
                 writeListing = true;
                 continue;
             }
+            if (arg == "--serve") {
+                serve = true;
+                continue;
+            }
+            if (arg == "--socket" && i + 1 < argc) {
+                socketPath = argv[++i];
+                continue;
+            }
+            if (arg == "--threads" && i + 1 < argc) {
+                threads = static_cast<unsigned>(std::max(0, std::stoi(argv[++i])));
+                continue;
+            }
+            if (arg == "--workers" && i + 1 < argc) {
+                workers = static_cast<size_t>(std::max(1, std::stoi(argv[++i])));
+                continue;
+            }
+            if (arg == "--sym-out" && i + 1 < argc) {
+                symOutputPath = argv[++i];
+                continue;
+            }
+            if (arg == "--map-out" && i + 1 < argc) {
+                mapOutputPath = argv[++i];
+                continue;
+            }
+            if (arg == "--map-json" && i + 1 < argc) {
+                mapJsonPath = argv[++i];
+                continue;
+            }
+            if (arg == "--cycles-json" && i + 1 < argc) {
+                cyclesJsonPath = argv[++i];
+                continue;
+            }
+            if (arg == "--line-map" && i + 1 < argc) {
+                lineMapPath = argv[++i];
+                continue;
+            }
+            if (arg == "--cache-dir" && i + 1 < argc) {
+                cacheDir = argv[++i];
+                continue;
+            }
+            if (arg == "--depfile" && i + 1 < argc) {
+                depfilePath = argv[++i];
+                continue;
+            }
             if (!arg.empty() && arg[0] == '-') {
                 std::cerr << "Argumento no reconocido: " << arg << "\n";
                 printUsage(argv[0]);
@@ -146,6 +277,10 @@ int main(int argc, char* argv[]) {
             asmPath = arg;
         }
 
+        if (serve) {
+            return runServer({fs::canonical(fs::path(PROJECT_ROOT_PATH)), socketPath, workers});
+        }
+
         if (asmPath.empty()) {
             printUsage(argv[0]);
             return 1;
@@ -159,7 +294,7 @@ int main(int argc, char* argv[]) {
 
         if (hexOutputPath.empty()) {
             hexOutputPath = asmPath;
-            hexOutputPath.replace_extension(".hex");
+            hexOutputPath.replace_extension(objectOutput ? ".o" : ".hex");
         }
 
         if (writeListing && lstOutputPath.empty()) {
@@ -167,54 +302,119 @@ int main(int argc, char* argv[]) {
             lstOutputPath.replace_extension(".lst");
         }
 
-        const fs::path asmDir = asmPath.parent_path();
         const fs::path projectRoot = fs::canonical(fs::path(PROJECT_ROOT_PATH));
-
-        std::map<std::string, std::string> includeFiles;
-        std::set<std::string> visited;
-
-        // Cargar include por defecto si existe.
-        try {
-            const fs::path defaultDefs = resolveIncludePath("Megaprocessor_defs.asm", asmDir, projectRoot);
-            loadIncludeRecursive(defaultDefs, projectRoot, includeFiles, visited);
-        } catch (const std::exception&) {
-            // Opcional: algunos programas no lo usan.
+        const Project project = ProjectLoader(projectRoot, false).load(asmPath);
+
+        // Con --cache-dir, un fuente cuyo grafo de includes no cambió no se vuelve a ensamblar.
+        std::optional<BuildCache> cache;
+        std::string cacheKey;
+        CachedBuild build;
+        bool cacheHit = false;
+        if (!cacheDir.empty()) {
+            cache.emplace(cacheDir);
+            const std::string options = std::string(relaxBranches ? "relax;" : "") + (optimize ? "optimize;" : "") +
+                                        (objectOutput ? "obj;" : "") + (annotateCycles ? "cycles;" : "");
+            cacheKey = BuildCache::computeKey(project.source, project.includeFiles, options);
+            // Los mapas y los ciclos no se guardan en la caché; pedirlos obliga a ensamblar.
+            const bool wantsMap = !mapOutputPath.empty() || !mapJsonPath.empty() || !cyclesJsonPath.empty() ||
+                                  !lineMapPath.empty();
+            cacheHit = !wantsMap && cache->load(cacheKey, build);
         }
 
-        // Cargar includes declarados por el asm principal.
-        const std::string source = readFile(asmPath);
-        static const std::regex includeRegex(R"(^\s*include\s+([^\s]+))", std::regex::icase);
-        std::istringstream stream(source);
-        std::string line;
-        while (std::getline(stream, line)) {
-            std::smatch match;
-            if (!std::regex_search(line, match, includeRegex)) {
-                continue;
+        if (!cacheHit) {
+            Assembler::setAllocationCounter(allocationCount);
+            Assembler assembler;
+            assembler.setIncludeBuffers(project.includeFiles);
+            assembler.setIncludeGraph(project.includeGraph);
+            assembler.setBranchRelaxation(relaxBranches);
+            assembler.setPeepholeOptimization(optimize);
+            assembler.setObjectOutput(objectOutput);
+            assembler.setParallelism(threads);
+            assembler.setCycleAnnotation(annotateCycles);
+            build.hex = assembler.assembleBuffer(project.source);
+            if (showStats) {
+                printStats(assembler.getStats());
             }
-            const std::string includeName = normalizeIncludeToken(match[1].str());
-            if (includeName.empty()) {
-                continue;
+            if (build.hex.rfind("ERROR:", 0) == 0) {
+                std::cerr << build.hex << "\n";
+                printDiagnostics("Diagnósticos", assembler.getDiagnostics());
+                return 2;
             }
-            const fs::path includePath = resolveIncludePath(includeName, asmDir, projectRoot);
-            loadIncludeRecursive(includePath, projectRoot, includeFiles, visited);
-        }
-
-        Assembler assembler;
-        assembler.setIncludeFiles(includeFiles);
-        const std::string hex = assembler.assemble(source);
-        if (hex.rfind("ERROR:", 0) == 0) {
-            std::cerr << hex << "\n";
-            return 2;
+            if (optimize) {
+                const AssemblyStats& stats = assembler.getStats();
+                char summary[128];
+                std::snprintf(summary, sizeof(summary), "Optimizador: %zu reescrituras, %zu bytes y ~%zu ciclos ahorrados\n",
+                              stats.peepholeRewrites, stats.peepholeBytesSaved, stats.peepholeCyclesSaved);
+                build.optimizerSummary = summary;
+                std::cout << build.optimizerSummary;
+            }
+            if (!assembler.getWarnings().empty()) {
+                build.warnings = formatDiagnostics("Avisos", assembler.getWarnings());
+                std::cerr << build.warnings;
+            }
+            if (!mapOutputPath.empty() || !mapJsonPath.empty()) {
+                const MemoryMap map = assembler.getMemoryMap();
+                if (!mapOutputPath.empty()) writeFile(mapOutputPath, formatMemoryMap(map));
+                if (!mapJsonPath.empty()) writeFile(mapJsonPath, memoryMapToJson(map) + "\n");
+            }
+            if (!cyclesJsonPath.empty()) {
+                writeFile(cyclesJsonPath, cycleRegionsToJson(assembler.getCycleRegions()) + "\n");
+            }
+            if (!lineMapPath.empty()) {
+                writeFile(lineMapPath, lineMapToJson(assembler.getLineMap()) + "\n");
+            }
+            build.listing = assembler.getListing();
+            build.symbols = assembler.getSymbols();
+            if (cache) {
+                cache->store(cacheKey, build);
+            }
+        } else {
+            if (showStats) {
+                std::printf("Estadísticas: no disponibles, resultado tomado de la caché (%s)\n", cacheKey.c_str());
+            }
+            // Los avisos (p. ej. W_OVERLAP) y el resumen del optimizador se repiten en cada
+            // compilación, no solo en la primera.
+            std::cout << build.optimizerSummary;
+            std::cerr << build.warnings;
         }
 
-        writeFile(hexOutputPath, hex);
+        std::vector<fs::path> targets = {hexOutputPath};
+        writeFile(hexOutputPath, build.hex);
         if (writeListing) {
-            writeFile(lstOutputPath, assembler.getListing());
+            writeFile(lstOutputPath, build.listing);
+            targets.push_back(lstOutputPath);
+        }
+        if (!symOutputPath.empty()) {
+            writeFile(symOutputPath, build.symbols);
+            targets.push_back(symOutputPath);
+        }
+        if (!mapOutputPath.empty()) targets.push_back(mapOutputPath);
+        if (!mapJsonPath.empty()) targets.push_back(mapJsonPath);
+        if (!cyclesJsonPath.empty()) targets.push_back(cyclesJsonPath);
+        if (!lineMapPath.empty()) targets.push_back(lineMapPath);
+        if (!depfilePath.empty()) {
+            writeDepfile(depfilePath, targets, project.dependencies());
         }
 
-        std::cout << "HEX generado: " << fs::absolute(hexOutputPath) << "\n";
+        const char* origin = cacheHit ? " (caché)" : "";
+        std::cout << (objectOutput ? "Objeto generado" : "HEX generado") << origin << ": " << fs::absolute(hexOutputPath) << "\n";
         if (writeListing) {
-            std::cout << "LST generado: " << fs::absolute(lstOutputPath) << "\n";
+            std::cout << "LST generado" << origin << ": " << fs::absolute(lstOutputPath) << "\n";
+        }
+        if (!symOutputPath.empty()) {
+            std::cout << "Símbolos generados" << origin << ": " << fs::absolute(symOutputPath) << "\n";
+        }
+        if (!mapOutputPath.empty()) {
+            std::cout << "Mapa de memoria generado: " << fs::absolute(mapOutputPath) << "\n";
+        }
+        if (!mapJsonPath.empty()) {
+            std::cout << "Mapa de memoria (JSON) generado: " << fs::absolute(mapJsonPath) << "\n";
+        }
+        if (!cyclesJsonPath.empty()) {
+            std::cout << "Ciclos estimados (JSON) generados: " << fs::absolute(cyclesJsonPath) << "\n";
+        }
+        if (!lineMapPath.empty()) {
+            std::cout << "Mapa de direcciones a líneas generado: " << fs::absolute(lineMapPath) << "\n";
         }
         return 0;
     } catch (const std::exception& ex) {
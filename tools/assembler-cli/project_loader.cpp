@@ -0,0 +1,176 @@
+#include "project_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Proyecta y escanea todos los archivos de `paths` en paralelo. Son independientes entre sí,
+// así que cada hilo toma el siguiente archivo pendiente hasta agotar la lista.
+std::vector<std::shared_ptr<const SourceFile>> loadFilesInParallel(const std::vector<fs::path>& paths) {
+    std::vector<std::shared_ptr<const SourceFile>> files(paths.size());
+    std::vector<std::exception_ptr> failures(paths.size());
+    std::atomic<size_t> next{0};
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            try {
+                auto file = std::make_shared<SourceFile>();
+                file->path = paths[i];
+                file->mapped = MappedFile(paths[i]);
+                file->includes = scanIncludeDirectives(file->mapped.view());
+                files[i] = std::move(file);
+            } catch (...) {
+                failures[i] = std::current_exception();
+            }
+        }
+    };
+
+    const size_t threadCount = std::min<size_t>(paths.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < threadCount; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (const auto& failure : failures) {
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+    return files;
+}
+
+} // namespace
+
+std::vector<fs::path> Project::dependencies() const {
+    std::vector<fs::path> result = {path};
+    for (const auto& file : files) {
+        result.push_back(file->path);
+    }
+    return result;
+}
+
+fs::path resolveIncludePath(const std::string& includeName, const fs::path& asmDir, const fs::path& projectRoot) {
+    const fs::path includePath(includeName);
+
+    std::vector<fs::path> candidates = {
+        asmDir / includePath,
+        projectRoot / includePath,
+        projectRoot / "app" / "src" / "main" / "assets" / includePath,
+    };
+
+    for (const auto& candidate : candidates) {
+        if (fs::exists(candidate) && fs::is_regular_file(candidate)) {
+            return fs::canonical(candidate);
+        }
+    }
+
+    throw std::runtime_error("Include no encontrado: " + includeName);
+}
+
+ProjectLoader::ProjectLoader(fs::path projectRoot, bool keepWarm)
+    : projectRoot(std::move(projectRoot)), keepWarm(keepWarm) {}
+
+std::vector<std::shared_ptr<const SourceFile>> ProjectLoader::openFiles(const std::vector<fs::path>& paths) {
+    if (!keepWarm) {
+        return loadFilesInParallel(paths);
+    }
+
+    // Los archivos sin cambios salen de la caché; el resto se carga en paralelo fuera del lock.
+    std::vector<std::shared_ptr<const SourceFile>> files(paths.size());
+    std::vector<fs::path> stalePaths;
+    std::vector<size_t> staleIndexes;
+    std::vector<std::pair<fs::file_time_type, uintmax_t>> versions(paths.size());
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        for (size_t i = 0; i < paths.size(); ++i) {
+            versions[i] = {fs::last_write_time(paths[i]), fs::file_size(paths[i])};
+            auto it = cache.find(paths[i]);
+            if (it != cache.end() && it->second.modified == versions[i].first && it->second.size == versions[i].second) {
+                files[i] = it->second.file;
+            } else {
+                stalePaths.push_back(paths[i]);
+                staleIndexes.push_back(i);
+            }
+        }
+    }
+
+    if (!stalePaths.empty()) {
+        std::vector<std::shared_ptr<const SourceFile>> loaded = loadFilesInParallel(stalePaths);
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        for (size_t k = 0; k < loaded.size(); ++k) {
+            const size_t i = staleIndexes[k];
+            files[i] = loaded[k];
+            cache[paths[i]] = {loaded[k], versions[i].first, versions[i].second};
+        }
+    }
+    return files;
+}
+
+Project ProjectLoader::load(const fs::path& asmPath, std::shared_ptr<const std::string> inlineSource) {
+    Project project;
+    project.path = asmPath;
+    const fs::path asmDir = asmPath.parent_path();
+
+    if (inlineSource) {
+        project.inlineSource = std::move(inlineSource);
+        project.source = *project.inlineSource;
+    } else {
+        if (!fs::is_regular_file(asmPath)) {
+            throw std::runtime_error("Archivo de entrada no existe: " + asmPath.string());
+        }
+        project.mainFile = openFiles({fs::canonical(asmPath)}).front();
+        project.source = project.mainFile->mapped.view();
+    }
+
+    std::vector<fs::path> roots;
+
+    // Cargar include por defecto si existe.
+    try {
+        roots.push_back(resolveIncludePath("Megaprocessor_defs.asm", asmDir, projectRoot));
+    } catch (const std::exception&) {
+        // Opcional: algunos programas no lo usan.
+    }
+
+    // Cargar includes declarados por el asm principal.
+    std::vector<IncludeDirective>& mainIncludes = project.includeGraph[""];
+    mainIncludes = project.mainFile ? project.mainFile->includes : scanIncludeDirectives(project.source);
+    for (const IncludeDirective& include : mainIncludes) {
+        const fs::path includePath = resolveIncludePath(include.path, asmDir, projectRoot);
+        if (std::find(roots.begin(), roots.end(), includePath) == roots.end()) {
+            roots.push_back(includePath);
+        }
+    }
+
+    // Recorre el grafo por niveles: las directivas ya escaneadas de un nivel dan el siguiente.
+    std::set<fs::path> seen(roots.begin(), roots.end());
+    std::vector<fs::path> pending = std::move(roots);
+    while (!pending.empty()) {
+        std::vector<fs::path> nextLevel;
+        for (auto& file : openFiles(pending)) {
+            for (const IncludeDirective& include : file->includes) {
+                const fs::path nested = resolveIncludePath(include.path, file->path.parent_path(), projectRoot);
+                if (seen.insert(nested).second) {
+                    nextLevel.push_back(nested);
+                }
+            }
+            const std::string name = file->path.filename().string();
+            project.includeFiles[name] = file->mapped.view();
+            project.includeGraph[name] = file->includes;
+            project.files.push_back(std::move(file));
+        }
+        pending = std::move(nextLevel);
+    }
+    return project;
+}
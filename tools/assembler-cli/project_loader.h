@@ -0,0 +1,66 @@
+#ifndef PROJECT_LOADER_H
+#define PROJECT_LOADER_H
+
+#include "assembler.h"
+#include "mapped_file.h"
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Un archivo proyectado en memoria junto con las directivas INCLUDE que contiene.
+struct SourceFile {
+    std::filesystem::path path;
+    MappedFile mapped;
+    std::vector<IncludeDirective> includes;
+};
+
+// Fuente principal y todos los includes alcanzables, listos para el ensamblador.
+// `source`, `includeFiles` e `includeGraph` apuntan a memoria que el propio Project mantiene viva.
+struct Project {
+    std::filesystem::path path;
+    std::string_view source;
+    std::shared_ptr<const SourceFile> mainFile;
+    std::shared_ptr<const std::string> inlineSource;
+    std::vector<std::shared_ptr<const SourceFile>> files;
+    std::map<std::string, std::string_view> includeFiles;
+    IncludeGraph includeGraph;
+
+    // El fuente principal seguido de cada include cargado, para depfiles.
+    std::vector<std::filesystem::path> dependencies() const;
+};
+
+std::filesystem::path resolveIncludePath(const std::string& includeName, const std::filesystem::path& asmDir,
+                                         const std::filesystem::path& projectRoot);
+
+// Carga un programa y su grafo de includes: el fuente se escanea sin regex y cada nivel del
+// grafo se proyecta en paralelo. Con keepWarm los archivos quedan proyectados entre llamadas y
+// solo se releen si cambian su fecha de modificación o su tamaño. load() es seguro entre hilos.
+class ProjectLoader {
+public:
+    ProjectLoader(std::filesystem::path projectRoot, bool keepWarm);
+
+    // Si `inlineSource` no es nulo se usa en lugar del contenido de `asmPath`, que sigue
+    // sirviendo para resolver los includes relativos (buffers sin guardar de un editor).
+    Project load(const std::filesystem::path& asmPath, std::shared_ptr<const std::string> inlineSource = nullptr);
+
+private:
+    struct CacheEntry {
+        std::shared_ptr<const SourceFile> file;
+        std::filesystem::file_time_type modified;
+        uintmax_t size;
+    };
+
+    std::filesystem::path projectRoot;
+    bool keepWarm;
+    std::mutex cacheMutex;
+    std::map<std::filesystem::path, CacheEntry> cache;
+
+    std::vector<std::shared_ptr<const SourceFile>> openFiles(const std::vector<std::filesystem::path>& paths);
+};
+
+#endif // PROJECT_LOADER_H
@@ -0,0 +1,346 @@
+#include "server.h"
+#include "assembler.h"
+#include "json.h"
+#include "project_loader.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Una petición no puede superar este tamaño; protege al servidor de cabeceras corruptas.
+const size_t kMaxFrameBytes = 64 * 1024 * 1024;
+
+// Extremo de una conexión: stdin/stdout o un socket aceptado. Las respuestas de varios
+// trabajadores pueden llegar en cualquier orden, por eso la escritura va protegida.
+class Connection {
+public:
+    Connection(int inputFd, int outputFd, bool ownsFds) : inputFd(inputFd), outputFd(outputFd), ownsFds(ownsFds) {}
+
+    ~Connection() {
+        if (ownsFds) {
+            ::close(inputFd);
+            if (outputFd != inputFd) ::close(outputFd);
+        }
+    }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Lee la siguiente trama. Devuelve false al llegar al final de la entrada entre tramas.
+    bool readFrame(std::string& payload) {
+        std::string header;
+        char c;
+        while (true) {
+            if (!readByte(c)) {
+                if (header.empty()) return false;
+                throw std::runtime_error("trama truncada en la cabecera");
+            }
+            if (c == '\n') break;
+            if (c == '\r') continue;
+            if (c < '0' || c > '9' || header.size() >= 10) {
+                throw std::runtime_error("cabecera de longitud inválida");
+            }
+            header += c;
+        }
+        if (header.empty()) throw std::runtime_error("cabecera de longitud vacía");
+
+        const size_t length = static_cast<size_t>(std::stoull(header));
+        if (length > kMaxFrameBytes) throw std::runtime_error("trama demasiado grande");
+
+        payload.resize(length);
+        size_t done = 0;
+        // Primero lo que ya estaba en el buffer de lectura, luego directo al destino.
+        const size_t buffered = std::min(length, available());
+        std::memcpy(&payload[0], buffer.data() + bufferPos, buffered);
+        bufferPos += buffered;
+        done += buffered;
+        while (done < length) {
+            const ssize_t n = ::read(inputFd, &payload[done], length - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw std::runtime_error("trama truncada");
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void writeFrame(const std::string& payload) {
+        const std::string frame = std::to_string(payload.size()) + "\n" + payload;
+        std::lock_guard<std::mutex> lock(writeMutex);
+        size_t done = 0;
+        while (done < frame.size()) {
+            const ssize_t n = ::write(outputFd, frame.data() + done, frame.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            // El cliente se fue: no hay a quién avisar.
+            if (n <= 0) return;
+            done += static_cast<size_t>(n);
+        }
+    }
+
+private:
+    int inputFd;
+    int outputFd;
+    bool ownsFds;
+    std::mutex writeMutex;
+    std::vector<char> buffer = std::vector<char>(64 * 1024);
+    size_t bufferPos = 0;
+    size_t bufferEnd = 0;
+
+    size_t available() const { return bufferEnd - bufferPos; }
+
+    bool readByte(char& c) {
+        if (bufferPos == bufferEnd) {
+            ssize_t n;
+            do {
+                n = ::read(inputFd, buffer.data(), buffer.size());
+            } while (n < 0 && errno == EINTR);
+            if (n <= 0) return false;
+            bufferPos = 0;
+            bufferEnd = static_cast<size_t>(n);
+        }
+        c = buffer[bufferPos++];
+        return true;
+    }
+};
+
+struct Job {
+    std::shared_ptr<Connection> connection;
+    std::string payload;
+};
+
+// Cola compartida entre lectores de conexiones y trabajadores.
+class JobQueue {
+public:
+    // Una vez cerrada la cola, lo que siga llegando se descarta.
+    void push(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed) return;
+            jobs.push_back(std::move(job));
+        }
+        ready.notify_one();
+    }
+
+    // Bloquea hasta que haya trabajo. Devuelve false si la cola se cerró y quedó vacía.
+    bool pop(Job& job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]() { return closed || !jobs.empty(); });
+        if (jobs.empty()) return false;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Job> jobs;
+    bool closed = false;
+};
+
+void appendDiagnostics(std::string& out, const std::vector<Diagnostic>& diagnostics, const char* severity = "error") {
+    out += ",\"diagnostics\":[";
+    for (size_t i = 0; i < diagnostics.size(); ++i) {
+        const Diagnostic& d = diagnostics[i];
+        out += i == 0 ? "" : ",";
+        out += std::string("{\"severity\":\"") + severity + "\",\"line\":" + std::to_string(d.line) + ",\"column\":" +
+               std::to_string(d.column) + ",\"code\":";
+        appendJsonString(out, d.code);
+        out += ",\"message\":";
+        appendJsonString(out, d.message);
+        out += '}';
+    }
+    out += ']';
+}
+
+std::string errorResponse(std::string_view id, const std::vector<Diagnostic>& diagnostics) {
+    std::string out = "{\"id\":";
+    out += id.empty() ? std::string_view("null") : id;
+    out += ",\"ok\":false";
+    appendDiagnostics(out, diagnostics);
+    out += '}';
+    return out;
+}
+
+// Errores previos al ensamblado (petición o archivos inválidos): no tienen línea.
+std::string errorResponse(std::string_view id, const std::string& message) {
+    return errorResponse(id, std::vector<Diagnostic>{{0, 0, "E_REQUEST", message}});
+}
+
+bool flagOrDefault(const JsonValue& request, const std::string& key, bool fallback) {
+    const JsonValue* value = request.find(key);
+    return (value != nullptr && value->type == JsonValue::BOOLEAN) ? value->boolean : fallback;
+}
+
+// Atiende una petición:
+//   {"id": <cualquiera>, "path": "prog.asm", "source": "...", "listing": true, "symbols": false}
+// "source" es opcional (buffer sin guardar); "path" resuelve los includes relativos.
+std::string handleRequest(Assembler& assembler, ProjectLoader& loader, std::string_view payload) {
+    const auto start = std::chrono::steady_clock::now();
+
+    JsonValue request;
+    std::string parseError;
+    if (!parseJson(payload, request, parseError)) {
+        return errorResponse(std::string_view(), "JSON inválido: " + parseError);
+    }
+    const JsonValue* idValue = request.find("id");
+    const std::string_view id = idValue != nullptr ? idValue->raw : std::string_view();
+
+    const JsonValue* path = request.find("path");
+    if (path == nullptr || path->type != JsonValue::STRING || path->string.empty()) {
+        return errorResponse(id, "Falta \"path\"");
+    }
+
+    std::shared_ptr<const std::string> inlineSource;
+    if (const JsonValue* source = request.find("source")) {
+        if (source->type != JsonValue::STRING) return errorResponse(id, "\"source\" debe ser una cadena");
+        inlineSource = std::make_shared<const std::string>(source->string);
+    }
+
+    Project project;
+    try {
+        project = loader.load(fs::absolute(path->string), inlineSource);
+    } catch (const std::exception& ex) {
+        return errorResponse(id, ex.what());
+    }
+
+    assembler.setIncludeBuffers(project.includeFiles);
+    assembler.setIncludeGraph(project.includeGraph);
+    assembler.setBranchRelaxation(flagOrDefault(request, "relax", false));
+    assembler.setPeepholeOptimization(flagOrDefault(request, "optimize", false));
+    const std::string hex = assembler.assembleBuffer(project.source);
+    if (hex.rfind("ERROR: ", 0) == 0) {
+        return errorResponse(id, assembler.getDiagnostics());
+    }
+
+    std::string out = "{\"id\":";
+    out += id.empty() ? std::string_view("null") : id;
+    out += ",\"ok\":true,\"hex\":";
+    appendJsonString(out, hex);
+    if (flagOrDefault(request, "listing", true)) {
+        out += ",\"listing\":";
+        appendJsonString(out, assembler.getListing());
+    }
+    if (flagOrDefault(request, "symbols", false)) {
+        out += ",\"symbols\":";
+        appendJsonString(out, assembler.getSymbols());
+    }
+    // Un ensamblado correcto solo puede traer avisos.
+    appendDiagnostics(out, assembler.getWarnings(), "warning");
+    char elapsed[32];
+    std::snprintf(elapsed, sizeof(elapsed), ",\"ms\":%.3f}",
+                  std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    out += elapsed;
+    return out;
+}
+
+// Lee tramas de una conexión hasta el final y las encola. Una trama mal formada deja el
+// flujo desincronizado, así que se responde el error y se cierra la conexión.
+void readConnection(const std::shared_ptr<Connection>& connection, JobQueue& queue) {
+    try {
+        std::string payload;
+        while (connection->readFrame(payload)) {
+            queue.push({connection, std::move(payload)});
+            payload.clear();
+        }
+    } catch (const std::exception& ex) {
+        connection->writeFrame(errorResponse(std::string_view(), std::string("Trama inválida: ") + ex.what()));
+    }
+}
+
+int listenOnSocket(const fs::path& socketPath) {
+    const std::string pathText = socketPath.string();
+    sockaddr_un address {};
+    if (pathText.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Ruta de socket demasiado larga: " + pathText);
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, pathText.c_str(), sizeof(address.sun_path) - 1);
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("No se pudo crear el socket");
+    ::unlink(pathText.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, 16) != 0) {
+        ::close(fd);
+        throw std::runtime_error("No se pudo escuchar en: " + pathText + " (" + std::strerror(errno) + ")");
+    }
+    return fd;
+}
+
+} // namespace
+
+int runServer(const ServerOptions& options) {
+    // Escribir a un cliente desconectado no debe terminar el proceso.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    ProjectLoader loader(options.projectRoot, true);
+    // Los hilos lectores de cada conexión no se esperan al salir (pueden seguir bloqueados en
+    // un cliente que no cierra), así que comparten la cola en vez de apuntar a una local.
+    auto sharedQueue = std::make_shared<JobQueue>();
+    JobQueue& queue = *sharedQueue;
+
+    // Cada trabajador tiene su propio Assembler: la tabla de opcodes y la arena quedan calientes
+    // entre peticiones.
+    const size_t workerCount = std::max<size_t>(1, options.workers);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < workerCount; ++i) {
+        workers.emplace_back([&queue, &loader]() {
+            Assembler assembler;
+            Job job;
+            while (queue.pop(job)) {
+                job.connection->writeFrame(handleRequest(assembler, loader, job.payload));
+                job = Job();
+            }
+        });
+    }
+
+    if (options.socketPath.empty()) {
+        readConnection(std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO, false), queue);
+        queue.close();
+        for (auto& worker : workers) worker.join();
+        return 0;
+    }
+
+    const int listenFd = listenOnSocket(options.socketPath);
+    std::cerr << "Escuchando en " << options.socketPath << " con " << workerCount << " trabajadores\n";
+    while (true) {
+        const int clientFd = ::accept(listenFd, nullptr, nullptr);
+        if (clientFd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        auto connection = std::make_shared<Connection>(clientFd, clientFd, true);
+        std::thread([connection, sharedQueue]() { readConnection(connection, *sharedQueue); }).detach();
+    }
+    ::close(listenFd);
+    queue.close();
+    for (auto& worker : workers) worker.join();
+    return 1;
+}
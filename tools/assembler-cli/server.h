@@ -0,0 +1,19 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstddef>
+#include <filesystem>
+
+struct ServerOptions {
+    std::filesystem::path projectRoot;
+    // Vacío: atiende por stdin/stdout. Si no, escucha en este socket Unix.
+    std::filesystem::path socketPath;
+    size_t workers;
+};
+
+// Modo --serve: mantiene ensambladores y archivos de include residentes y atiende peticiones
+// enmarcadas como "<longitud>\n<json>". Con stdin termina al cerrarse la entrada, después de
+// responder todo lo pendiente; con socket atiende conexiones hasta que se detenga el proceso.
+int runServer(const ServerOptions& options);
+
+#endif // SERVER_H
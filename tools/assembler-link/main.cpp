@@ -0,0 +1,248 @@
+#include "object_file.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint32_t kMemorySize = 0x10000;
+
+// Una sección del programa final: la concatenación de las secciones homónimas de todos los
+// objetos, en el orden en que aparecen en la línea de órdenes.
+struct PlacedSection {
+    std::string name;
+    uint32_t start = 0;
+    uint32_t size = 0;
+    bool fixed = false;
+    // Dirección donde empieza la parte de cada objeto.
+    std::vector<uint32_t> moduleStart;
+};
+
+void printUsage(const char* programName) {
+    std::cerr << "Uso: " << programName << " <objeto.o> [<objeto.o> ...] [--out <programa.hex>]"
+              << " [--section <NOMBRE>=<dirección>] [--map]\n";
+}
+
+void writeFile(const std::string& filePath, const std::string& content) {
+    std::ofstream output(filePath, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        throw std::runtime_error("No se pudo escribir: " + filePath);
+    }
+    output << content;
+}
+
+uint32_t parseAddress(const std::string& text) {
+    size_t used = 0;
+    const bool hex = text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+    const unsigned long value = std::stoul(hex ? text.substr(2) : text, &used, hex ? 16 : 10);
+    if (used != text.size() - (hex ? 2 : 0) || value >= kMemorySize) {
+        throw std::runtime_error("Dirección inválida: " + text);
+    }
+    return static_cast<uint32_t>(value);
+}
+
+void appendHexByte(std::string& out, uint8_t value) {
+    static const char digits[] = "0123456789ABCDEF";
+    out += digits[value >> 4];
+    out += digits[value & 0x0F];
+}
+
+// Mismo formato que el ensamblador: registros de hasta 32 bytes contiguos.
+std::string writeIntelHex(const std::vector<uint8_t>& memory, const std::vector<bool>& used) {
+    std::string out;
+    uint32_t address = 0;
+    while (address < kMemorySize) {
+        if (!used[address]) {
+            ++address;
+            continue;
+        }
+        uint32_t count = 0;
+        while (count < 0x20 && address + count < kMemorySize && used[address + count]) ++count;
+        int checksum = static_cast<int>(count + (address >> 8) + (address & 0xFF));
+        out += ':';
+        appendHexByte(out, static_cast<uint8_t>(count));
+        appendHexByte(out, static_cast<uint8_t>(address >> 8));
+        appendHexByte(out, static_cast<uint8_t>(address & 0xFF));
+        out += "00";
+        for (uint32_t i = 0; i < count; ++i) {
+            appendHexByte(out, memory[address + i]);
+            checksum += memory[address + i];
+        }
+        appendHexByte(out, static_cast<uint8_t>((~checksum + 1) & 0xFF));
+        out += '\n';
+        address += count;
+    }
+    out += ":00000001FF\n";
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        std::vector<std::string> inputs;
+        std::string outputPath;
+        std::map<std::string, uint32_t> fixedSections;
+        bool showMap = false;
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--out" && i + 1 < argc) {
+                outputPath = argv[++i];
+                continue;
+            }
+            if (arg == "--section" && i + 1 < argc) {
+                const std::string spec = argv[++i];
+                const size_t equals = spec.find('=');
+                if (equals == std::string::npos || equals == 0) {
+                    std::cerr << "Se esperaba --section NOMBRE=dirección: " << spec << "\n";
+                    return 1;
+                }
+                fixedSections[spec.substr(0, equals)] = parseAddress(spec.substr(equals + 1));
+                continue;
+            }
+            if (arg == "--map") {
+                showMap = true;
+                continue;
+            }
+            if (!arg.empty() && arg[0] == '-') {
+                std::cerr << "Argumento no reconocido: " << arg << "\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+            inputs.push_back(arg);
+        }
+        if (inputs.empty()) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (outputPath.empty()) {
+            outputPath = inputs.front();
+            const size_t dot = outputPath.find_last_of('.');
+            if (dot != std::string::npos && outputPath.find('/', dot) == std::string::npos) outputPath.resize(dot);
+            outputPath += ".hex";
+        }
+
+        std::vector<ObjectFile> objects;
+        for (const std::string& input : inputs) objects.push_back(readObjectFile(input));
+
+        // Cada sección se agrupa por nombre y la parte de cada objeto va detrás de la del anterior.
+        std::vector<PlacedSection> sections;
+        std::map<std::string, size_t> sectionIndex;
+        for (size_t m = 0; m < objects.size(); ++m) {
+            for (const ObjectFile::Section& section : objects[m].sections) {
+                auto found = sectionIndex.find(section.name);
+                if (found == sectionIndex.end()) {
+                    found = sectionIndex.emplace(section.name, sections.size()).first;
+                    sections.push_back(PlacedSection{section.name, 0, 0, false, std::vector<uint32_t>(objects.size(), 0)});
+                }
+                PlacedSection& placed = sections[found->second];
+                placed.moduleStart[m] = placed.size;
+                placed.size += section.size;
+            }
+        }
+        for (const auto& entry : fixedSections) {
+            if (sectionIndex.find(entry.first) == sectionIndex.end()) {
+                throw std::runtime_error("--section nombra una sección que ningún objeto define: " + entry.first);
+            }
+        }
+
+        // Las secciones sin dirección fija siguen a la anterior, empezando en 0.
+        uint32_t next = 0;
+        for (PlacedSection& section : sections) {
+            auto fixed = fixedSections.find(section.name);
+            section.fixed = fixed != fixedSections.end();
+            section.start = section.fixed ? fixed->second : next;
+            if (section.start + section.size > kMemorySize) {
+                throw std::runtime_error("La sección " + section.name + " no cabe en 64 KB");
+            }
+            for (uint32_t& start : section.moduleStart) start += section.start;
+            next = section.start + section.size;
+        }
+        for (size_t a = 0; a < sections.size(); ++a) {
+            for (size_t b = a + 1; b < sections.size(); ++b) {
+                if (sections[a].size == 0 || sections[b].size == 0) continue;
+                if (sections[a].start < sections[b].start + sections[b].size &&
+                    sections[b].start < sections[a].start + sections[a].size) {
+                    throw std::runtime_error("Las secciones " + sections[a].name + " y " + sections[b].name + " se solapan");
+                }
+            }
+        }
+        auto moduleAddress = [&](size_t module, const std::string& section) {
+            return sections[sectionIndex.at(section)].moduleStart[module];
+        };
+
+        std::map<std::string, uint16_t> globals;
+        for (size_t m = 0; m < objects.size(); ++m) {
+            for (const ObjectFile::Global& global : objects[m].globals) {
+                const uint32_t address = global.value + (global.section.empty() ? 0 : moduleAddress(m, global.section));
+                if (!globals.emplace(global.name, static_cast<uint16_t>(address)).second) {
+                    throw std::runtime_error("Símbolo global duplicado: " + global.name + " (" + objects[m].path + ")");
+                }
+            }
+        }
+
+        std::vector<uint8_t> memory(kMemorySize, 0);
+        std::vector<bool> used(kMemorySize, false);
+        for (size_t m = 0; m < objects.size(); ++m) {
+            for (const ObjectFile::Chunk& chunk : objects[m].chunks) {
+                const uint32_t start = moduleAddress(m, chunk.section) + chunk.offset;
+                if (start + chunk.count > kMemorySize) {
+                    throw std::runtime_error(objects[m].path + ": datos fuera de la memoria en la sección " + chunk.section);
+                }
+                for (uint32_t i = 0; i < chunk.count; ++i) {
+                    memory[start + i] = chunk.bytes.empty() ? chunk.value : chunk.bytes[i];
+                    used[start + i] = true;
+                }
+            }
+        }
+
+        // Cada campo reubicado es una palabra little-endian a la que se suma la dirección final.
+        size_t patched = 0;
+        for (size_t m = 0; m < objects.size(); ++m) {
+            for (const ObjectFile::Relocation& relocation : objects[m].relocations) {
+                uint32_t target;
+                if (relocation.isExtern) {
+                    auto global = globals.find(relocation.target);
+                    if (global == globals.end()) {
+                        throw std::runtime_error(objects[m].path + ": símbolo externo sin resolver: " + relocation.target);
+                    }
+                    target = global->second;
+                } else {
+                    target = moduleAddress(m, relocation.target);
+                }
+                const uint32_t at = moduleAddress(m, relocation.section) + relocation.offset;
+                if (at + 1 >= kMemorySize || !used[at] || !used[at + 1]) {
+                    throw std::runtime_error(objects[m].path + ": reubicación fuera de los datos de " + relocation.section);
+                }
+                const uint16_t value = static_cast<uint16_t>(memory[at] | (memory[at + 1] << 8));
+                const uint16_t result = static_cast<uint16_t>(value + target);
+                memory[at] = static_cast<uint8_t>(result & 0xFF);
+                memory[at + 1] = static_cast<uint8_t>(result >> 8);
+                ++patched;
+            }
+        }
+
+        writeFile(outputPath, writeIntelHex(memory, used));
+        if (showMap) {
+            for (const PlacedSection& section : sections) {
+                std::printf("Sección %-12s %04X-%04X %5u bytes%s\n", section.name.c_str(), section.start,
+                            section.size == 0 ? section.start : section.start + section.size - 1, section.size,
+                            section.fixed ? " (fija)" : "");
+            }
+            for (const auto& global : globals) {
+                std::printf("  %-20s %04X\n", global.first.c_str(), global.second);
+            }
+        }
+        std::cout << "HEX enlazado (" << objects.size() << " objetos, " << patched << " reubicaciones): " << outputPath << "\n";
+        return 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Fallo: " << ex.what() << "\n";
+        return 1;
+    }
+}
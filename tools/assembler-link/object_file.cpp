@@ -0,0 +1,127 @@
+#include "object_file.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+uint32_t parseHex(const std::string& text, const std::string& where) {
+    size_t used = 0;
+    unsigned long value = 0;
+    try {
+        value = std::stoul(text, &used, 16);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used != text.size() || value > 0x10000) {
+        throw std::runtime_error(where + ": número hexadecimal inválido '" + text + "'");
+    }
+    return static_cast<uint32_t>(value);
+}
+
+const ObjectFile::Section* findSection(const ObjectFile& object, const std::string& name) {
+    for (const ObjectFile::Section& section : object.sections) {
+        if (section.name == name) return &section;
+    }
+    return nullptr;
+}
+
+bool hasSection(const ObjectFile& object, const std::string& name) {
+    return findSection(object, name) != nullptr;
+}
+
+} // namespace
+
+ObjectFile readObjectFile(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("No se pudo leer: " + path);
+    }
+
+    ObjectFile object;
+    object.path = path;
+    std::string line;
+    int lineNumber = 0;
+    bool ended = false;
+    while (std::getline(input, line)) {
+        ++lineNumber;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        const std::string where = path + ":" + std::to_string(lineNumber);
+        if (ended) {
+            throw std::runtime_error(where + ": contenido después de END");
+        }
+
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+        if (lineNumber == 1) {
+            std::string version;
+            fields >> version;
+            if (kind != "MEGAOBJ" || version != "1") {
+                throw std::runtime_error(path + ": no es un objeto MEGAOBJ 1");
+            }
+            continue;
+        }
+
+        std::string a, b, c, d;
+        fields >> a >> b >> c >> d;
+        if (kind == "SECTION" && !b.empty()) {
+            object.sections.push_back({a, parseHex(b, where)});
+        } else if (kind == "EXTERN" && !a.empty()) {
+            object.externs.push_back(a);
+        } else if (kind == "DATA" && !c.empty()) {
+            ObjectFile::Chunk chunk{a, parseHex(b, where), {}, 0, 0};
+            if (c.size() % 2 != 0) {
+                throw std::runtime_error(where + ": DATA con un número impar de dígitos");
+            }
+            for (size_t i = 0; i < c.size(); i += 2) {
+                chunk.bytes.push_back(static_cast<uint8_t>(parseHex(c.substr(i, 2), where)));
+            }
+            chunk.count = static_cast<uint32_t>(chunk.bytes.size());
+            object.chunks.push_back(std::move(chunk));
+        } else if (kind == "FILL" && !d.empty()) {
+            object.chunks.push_back({a, parseHex(b, where), {}, parseHex(c, where), static_cast<uint8_t>(parseHex(d, where))});
+        } else if (kind == "GLOBAL" && !c.empty()) {
+            const uint32_t value = parseHex(c, where);
+            if (value > 0xFFFF) {
+                throw std::runtime_error(where + ": valor de GLOBAL fuera de 16 bits '" + c + "'");
+            }
+            object.globals.push_back({a, b == "*" ? std::string() : b, static_cast<uint16_t>(value)});
+        } else if (kind == "RELOC" && !d.empty() && (c == "SECTION" || c == "EXTERN")) {
+            object.relocations.push_back({a, parseHex(b, where), c == "EXTERN", d});
+        } else if (kind == "END") {
+            ended = true;
+        } else {
+            throw std::runtime_error(where + ": registro no reconocido '" + line + "'");
+        }
+    }
+    if (lineNumber == 0) {
+        throw std::runtime_error(path + ": archivo vacío");
+    }
+    if (!ended) {
+        throw std::runtime_error(path + ": falta END (¿objeto truncado?)");
+    }
+
+    // Todo lo que nombra una sección debe referirse a una declarada en el mismo objeto, y los
+    // datos deben caber en el tamaño declarado: si no, pisarían la sección o el módulo siguiente.
+    for (const ObjectFile::Chunk& chunk : object.chunks) {
+        const ObjectFile::Section* section = findSection(object, chunk.section);
+        if (section == nullptr) throw std::runtime_error(path + ": sección desconocida " + chunk.section);
+        if (chunk.offset + chunk.count > section->size) {
+            throw std::runtime_error(path + ": datos fuera de la sección " + chunk.section);
+        }
+    }
+    for (const ObjectFile::Global& global : object.globals) {
+        if (!global.section.empty() && !hasSection(object, global.section)) {
+            throw std::runtime_error(path + ": sección desconocida " + global.section);
+        }
+    }
+    for (const ObjectFile::Relocation& relocation : object.relocations) {
+        if (!hasSection(object, relocation.section) || (!relocation.isExtern && !hasSection(object, relocation.target))) {
+            throw std::runtime_error(path + ": reubicación con una sección desconocida");
+        }
+    }
+    return object;
+}
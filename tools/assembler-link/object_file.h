@@ -0,0 +1,46 @@
+#ifndef OBJECT_FILE_H
+#define OBJECT_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Un objeto reubicable tal como lo escribe `assembler-cli --obj` (ver docs/object-format.md).
+// Los desplazamientos son relativos al inicio de la sección dentro de este módulo.
+struct ObjectFile {
+    struct Section {
+        std::string name;
+        uint32_t size;
+    };
+    // Bytes de un registro DATA, o `count` copias de `value` si viene de un FILL.
+    struct Chunk {
+        std::string section;
+        uint32_t offset;
+        std::vector<uint8_t> bytes;
+        uint32_t count;
+        uint8_t value;
+    };
+    struct Global {
+        std::string name;
+        std::string section; // vacío si el valor es absoluto
+        uint16_t value;
+    };
+    struct Relocation {
+        std::string section;
+        uint32_t offset;
+        bool isExtern;
+        std::string target;
+    };
+
+    std::string path;
+    std::vector<Section> sections;
+    std::vector<std::string> externs;
+    std::vector<Chunk> chunks;
+    std::vector<Global> globals;
+    std::vector<Relocation> relocations;
+};
+
+// Lee y valida un objeto. Lanza std::runtime_error con la ruta y la línea si está mal formado.
+ObjectFile readObjectFile(const std::string& path);
+
+#endif // OBJECT_FILE_H
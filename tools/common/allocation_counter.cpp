@@ -0,0 +1,49 @@
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> gAllocationCount{0};
+std::atomic<uint64_t> gAllocatedBytes{0};
+
+} // namespace
+
+uint64_t allocationCount() {
+    return gAllocationCount.load(std::memory_order_relaxed);
+}
+
+uint64_t allocatedBytes() {
+    return gAllocatedBytes.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    gAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
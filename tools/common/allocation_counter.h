@@ -0,0 +1,11 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+// Contadores de memoria dinámica del proceso. Enlazar allocation_counter.cpp
+// reemplaza los operadores globales new/delete para que cada asignación pase por aquí.
+uint64_t allocationCount();
+uint64_t allocatedBytes();
+
+#endif // ALLOCATION_COUNTER_H
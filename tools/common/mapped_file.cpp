@@ -0,0 +1,59 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+MappedFile::MappedFile(const std::filesystem::path& filePath) {
+    const int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("No se pudo abrir: " + filePath.string());
+    }
+
+    struct stat info {};
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("No se pudo leer: " + filePath.string());
+    }
+
+    // mmap no acepta longitud 0: un archivo vacío queda como vista vacía.
+    if (info.st_size > 0) {
+        void* mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("No se pudo proyectar en memoria: " + filePath.string());
+        }
+        address = mapped;
+        length = static_cast<size_t>(info.st_size);
+        // El ensamblador recorre el texto de principio a fin.
+        ::madvise(address, length, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    release();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : address(std::exchange(other.address, nullptr)), length(std::exchange(other.length, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        address = std::exchange(other.address, nullptr);
+        length = std::exchange(other.length, 0);
+    }
+    return *this;
+}
+
+void MappedFile::release() {
+    if (address != nullptr) {
+        ::munmap(address, length);
+        address = nullptr;
+        length = 0;
+    }
+}
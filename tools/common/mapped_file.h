@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+// Archivo proyectado en memoria de solo lectura. view() apunta directamente a las
+// páginas del archivo y es válido mientras viva el objeto; nada se copia al abrir.
+class MappedFile {
+public:
+    MappedFile() = default;
+    // Lanza std::runtime_error si el archivo no se puede abrir o proyectar.
+    explicit MappedFile(const std::filesystem::path& filePath);
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view view() const { return std::string_view(static_cast<const char*>(address), length); }
+
+private:
+    void* address = nullptr;
+    size_t length = 0;
+
+    void release();
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,9 @@
+; DS n,v emits n copies of v; DS n,? only reserves the space
+ORG 0x0700
+DB 0x01
+DS 40,0xAA      ; run-length fill spanning two HEX records
+DB 0x02
+DS 16,?         ; reserved: nothing is written, the next byte moves on
+DB 0x03
+DS 3            ; fill defaults to 0
+DB 0x04
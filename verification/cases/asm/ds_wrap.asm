@@ -0,0 +1,4 @@
+; A fill longer than memory wraps past 0xFFFF twice, writing over its own first pass
+ORG 0xFFFE
+DS 0x10004,0x5A
+DB 0x01
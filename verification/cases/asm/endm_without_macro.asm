@@ -0,0 +1,3 @@
+; ENDM with no MACRO open is an error
+NOP
+ENDM
@@ -0,0 +1,3 @@
+; ENDR with no REPT open is an error
+NOP
+ENDR
@@ -0,0 +1,15 @@
+; flags: --check-allocations
+; Forward references and deferred EQUs: a reused Assembler assembles this again without allocating
+START EQU 0x0400
+ORG START
+LD.W R0, #COUNT
+BNE done
+JMP done
+LD.B R1, table
+COUNT EQU LAST - FIRST + 1
+LAST EQU 0x0F
+FIRST EQU 0x01
+done:
+NOP
+table:
+DB COUNT, LAST
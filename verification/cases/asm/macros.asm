@@ -0,0 +1,27 @@
+; Preprocessor: nested macro calls, \@ local labels, REPT, IF/ELSE and EQUs resolved to a fixed point
+SIZE EQU COUNT*2        ; refers to a constant defined below
+COUNT EQU 3
+ORG 0x0600
+wait MACRO reg
+loop\@: DEC reg
+BNE loop\@
+ENDM
+twice MACRO reg
+wait reg
+wait reg
+ENDM
+start:
+twice R0
+REPT SIZE
+NOP
+ENDR
+IF COUNT-3
+DB 0xEE                 ; false branch: not assembled
+ELSE
+DB 0x11
+ENDIF
+IF COUNT
+REPT 2
+DB COUNT
+ENDR
+ENDIF
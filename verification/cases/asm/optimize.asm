@@ -0,0 +1,10 @@
+; flags: --optimize
+; Peephole rewrites: LD.W Rx,#0 becomes CLR only when the flags it sets are dead, JMP becomes BUC in range
+ORG 0x0400
+start:
+LD.W R0,#0      ; ADD overwrites the flags: becomes CLR R0
+ADD R0,R1
+LD.W R1,#0      ; BEQ reads the flags: stays LD.W
+BEQ start
+JMP start       ; in range: becomes BUC
+JMP 0x2000      ; out of range: stays JMP
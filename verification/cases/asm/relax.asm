@@ -0,0 +1,14 @@
+; flags: --relax
+; Branch relaxation: an out-of-range Bxx becomes the inverted branch with offset 3 over a JMP
+ORG 0x0300
+start:
+BPL edge        ; in range on the first pass, pushed out of range once BEQ grows
+BEQ far         ; forward, out of range
+DS 124
+edge:
+NOP
+DS 130
+far:
+NOP
+BCC start       ; backward, out of range
+BNE far         ; backward, in range: stays short
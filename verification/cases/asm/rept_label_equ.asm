@@ -0,0 +1,7 @@
+; A REPT count from an EQU that depends on a label cannot be known while preprocessing
+start: NOP
+SIZE EQU end-start
+REPT SIZE
+NOP
+ENDR
+end: NOP
@@ -0,0 +1,7 @@
+; Main module: calls into the library and refers to its own section
+        EXTERN print
+        GLOBAL start
+start:  LD.W R2,#message    ; RELOC ... SECTION CODE
+        JSR print           ; RELOC ... EXTERN print
+        JMP start           ; RELOC ... SECTION CODE
+message: DM "HI"
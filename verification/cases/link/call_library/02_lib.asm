@@ -0,0 +1,6 @@
+; Library module: placed after the main module, so its own references move with it
+        GLOBAL print
+print:  LD.B R1,(R2)
+        BEQ done
+        JMP print           ; RELOC ... SECTION CODE
+done:   RET
@@ -0,0 +1,3 @@
+; The same modules as one flat program: SECTION, GLOBAL and EXTERN are ignored
+INCLUDE "01_main.asm"
+INCLUDE "02_lib.asm"
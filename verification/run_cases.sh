@@ -3,20 +3,31 @@ set -euo pipefail
 
 ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
 CASES_DIR="$ROOT_DIR/verification/cases/asm"
+LINK_DIR="$ROOT_DIR/verification/cases/link"
 INCLUDES_DIR="$CASES_DIR/includes"
 EXPECTED_DIR="$ROOT_DIR/verification/cases/expected"
 ACTUAL_DIR="$ROOT_DIR/verification/cases/actual"
 RESULTS_FILE="$ROOT_DIR/verification/results.md"
 RUNNER="/tmp/assemble_cli_megaprocessor"
+LINKER="/tmp/assembler_link_megaprocessor"
 
 mkdir -p "$ACTUAL_DIR"
 
-c++ -std=c++17 -I"$ROOT_DIR/verification/tools" \
+c++ -std=c++17 -pthread -I"$ROOT_DIR/verification/tools" \
   "$ROOT_DIR/verification/tools/assemble_cli.cpp" \
   "$ROOT_DIR/app/src/main/cpp/assembler.cpp" \
+  "$ROOT_DIR/app/src/main/cpp/line_scanner.cpp" \
+  "$ROOT_DIR/app/src/main/cpp/arena.cpp" \
   "$ROOT_DIR/app/src/main/cpp/utils.cpp" \
+  "$ROOT_DIR/tools/common/mapped_file.cpp" \
+  "$ROOT_DIR/tools/common/allocation_counter.cpp" \
   -o "$RUNNER"
 
+c++ -std=c++17 \
+  "$ROOT_DIR/tools/assembler-link/main.cpp" \
+  "$ROOT_DIR/tools/assembler-link/object_file.cpp" \
+  -o "$LINKER"
+
 {
   echo "# Verification results"
   echo
@@ -28,9 +39,27 @@ status_code=0
 for asm_file in "$CASES_DIR"/*.asm; do
   case_name="$(basename "$asm_file" .asm)"
   expected_file="$EXPECTED_DIR/$case_name.hex"
+  expected_error="$EXPECTED_DIR/$case_name.err"
   actual_file="$ACTUAL_DIR/$case_name.hex"
+  # Opciones del runner en una primera línea "; flags: --relax ...".
+  read -r -a flags <<< "$(sed -n '1s/^; *flags: *//p' "$asm_file")"
 
-  if "$RUNNER" "$asm_file" "$INCLUDES_DIR" > "$actual_file"; then
+  # Un caso con .err esperado debe fallar con exactamente ese mensaje.
+  if [[ -f "$expected_error" ]]; then
+    actual_error="$ACTUAL_DIR/$case_name.err"
+    if "$RUNNER" "$asm_file" "$INCLUDES_DIR" ${flags[@]+"${flags[@]}"} > /dev/null 2> "$actual_error"; then
+      echo "| $case_name | ❌ FAIL | Assembled, but an error was expected |" >> "$RESULTS_FILE"
+      status_code=1
+    elif diff -u "$expected_error" "$actual_error" > /tmp/${case_name}_err.diff; then
+      echo "| $case_name | ✅ PASS | Error matches expected |" >> "$RESULTS_FILE"
+    else
+      echo "| $case_name | ❌ FAIL | Error differs from expected (\`diff -u verification/cases/expected/$case_name.err verification/cases/actual/$case_name.err\`) |" >> "$RESULTS_FILE"
+      status_code=1
+    fi
+    continue
+  fi
+
+  if "$RUNNER" "$asm_file" "$INCLUDES_DIR" ${flags[@]+"${flags[@]}"} > "$actual_file"; then
     if [[ -f "$expected_file" ]]; then
       expected_norm="/tmp/${case_name}_expected.norm.hex"
       actual_norm="/tmp/${case_name}_actual.norm.hex"
@@ -53,6 +82,40 @@ for asm_file in "$CASES_DIR"/*.asm; do
   fi
 done
 
+# Cada directorio de cases/link es un programa en módulos: los NN_*.asm se ensamblan con
+# --obj y se enlazan en ese orden, y flat.asm los incluye como un solo programa. Los dos
+# HEX deben coincidir con expected/link_<nombre>.hex.
+for link_case in "$LINK_DIR"/*/; do
+  case_name="link_$(basename "$link_case")"
+  expected_file="$EXPECTED_DIR/$case_name.hex"
+  actual_file="$ACTUAL_DIR/$case_name.hex"
+  flat_file="$ACTUAL_DIR/${case_name}_flat.hex"
+
+  objects=()
+  failed=0
+  for module in "$link_case"[0-9][0-9]_*.asm; do
+    object_file="$ACTUAL_DIR/${case_name}_$(basename "$module" .asm).o"
+    "$RUNNER" "$module" "$link_case" --obj > "$object_file" || failed=1
+    objects+=("$object_file")
+  done
+  if [[ $failed -ne 0 ]] || ! "$LINKER" "${objects[@]}" --out "$actual_file" > /dev/null ||
+     ! "$RUNNER" "$link_case/flat.asm" "$link_case" > "$flat_file"; then
+    echo "| $case_name | ❌ FAIL | Assembler or linker returned error |" >> "$RESULTS_FILE"
+    status_code=1
+  elif [[ ! -f "$expected_file" ]]; then
+    echo "| $case_name | ⚠️ WARN | Missing expected file: verification/cases/expected/$case_name.hex |" >> "$RESULTS_FILE"
+    status_code=1
+  elif ! diff -u "$expected_file" "$actual_file" > /tmp/${case_name}_hex.diff; then
+    echo "| $case_name | ❌ FAIL | Linked output differs from expected |" >> "$RESULTS_FILE"
+    status_code=1
+  elif ! diff -u "$expected_file" "$flat_file" > /tmp/${case_name}_flat.diff; then
+    echo "| $case_name | ❌ FAIL | Flat assembly differs from the linked program |" >> "$RESULTS_FILE"
+    status_code=1
+  else
+    echo "| $case_name | ✅ PASS | Linked and flat output match expected |" >> "$RESULTS_FILE"
+  fi
+done
+
 cat >> "$RESULTS_FILE" <<'GAPS'
 
 ## Implementation gaps detected
@@ -1,28 +1,25 @@
 #include <filesystem>
-#include <fstream>
 #include <iostream>
 #include <map>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "../../app/src/main/cpp/assembler.h"
 #include "../../app/src/main/cpp/utils.h"
+#include "../../tools/common/allocation_counter.h"
+#include "../../tools/common/mapped_file.h"
 
 namespace fs = std::filesystem;
 
-std::string readFile(const fs::path& path) {
-    std::ifstream in(path);
-    std::stringstream buffer;
-    buffer << in.rdbuf();
-    return buffer.str();
-}
-
-void loadIncludeFiles(const fs::path& includeRoot, std::map<std::string, std::string>& includes) {
+void loadIncludeFiles(const fs::path& includeRoot, std::vector<MappedFile>& files,
+                      std::map<std::string, std::string_view>& includes) {
     if (!fs::exists(includeRoot)) return;
 
     for (const auto& entry : fs::recursive_directory_iterator(includeRoot)) {
         if (!entry.is_regular_file()) continue;
-        std::string content = readFile(entry.path());
+        files.emplace_back(entry.path());
+        std::string_view content = files.back().view();
 
         std::string baseName = toUpper(trim(entry.path().filename().string()));
         includes[baseName] = content;
@@ -33,27 +30,64 @@ void loadIncludeFiles(const fs::path& includeRoot, std::map<std::string, std::st
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2 || argc > 3) {
-        std::cerr << "usage: assemble_cli <source.asm> [include_dir]" << std::endl;
+    std::vector<std::string> positional;
+    bool relax = false;
+    bool optimize = false;
+    bool object = false;
+    bool checkAllocations = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--relax") relax = true;
+        else if (arg == "--optimize") optimize = true;
+        else if (arg == "--obj") object = true;
+        else if (arg == "--check-allocations") checkAllocations = true;
+        else positional.push_back(arg);
+    }
+    if (positional.empty() || positional.size() > 2) {
+        std::cerr << "usage: assemble_cli <source.asm> [include_dir] [--relax] [--optimize] [--obj] [--check-allocations]" << std::endl;
         return 2;
     }
 
-    fs::path sourcePath = argv[1];
-    fs::path includeDir = argc == 3 ? fs::path(argv[2]) : sourcePath.parent_path() / "includes";
+    fs::path sourcePath = positional[0];
+    fs::path includeDir = positional.size() == 2 ? fs::path(positional[1]) : sourcePath.parent_path() / "includes";
 
-    std::string source = readFile(sourcePath);
-    std::map<std::string, std::string> includes;
-    loadIncludeFiles(includeDir, includes);
+    MappedFile source;
+    std::vector<MappedFile> includeFiles;
+    std::map<std::string, std::string_view> includes;
+    try {
+        source = MappedFile(sourcePath);
+        loadIncludeFiles(includeDir, includeFiles, includes);
+    } catch (const std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
 
     Assembler assembler;
-    assembler.setIncludeFiles(includes);
+    assembler.setIncludeBuffers(includes);
+    assembler.setBranchRelaxation(relax);
+    assembler.setPeepholeOptimization(optimize);
+    assembler.setObjectOutput(object);
 
-    std::string output = assembler.assemble(source);
+    std::string output = assembler.assembleBuffer(source.view());
     if (output.rfind("ERROR:", 0) == 0) {
         std::cerr << output << std::endl;
         return 1;
     }
 
+    // Un Assembler reutilizado no debe pedir memoria al volver a ensamblar el mismo fuente.
+    if (checkAllocations) {
+        Assembler::setAllocationCounter(allocationCount);
+        if (assembler.assembleBuffer(source.view()) != output) {
+            std::cerr << "second assembly differs from the first" << std::endl;
+            return 1;
+        }
+        const uint64_t allocations = assembler.getStats().allocations;
+        if (allocations != 0) {
+            std::cerr << "second assembly made " << allocations << " allocation(s)" << std::endl;
+            return 1;
+        }
+    }
+
     std::cout << output;
     return 0;
 }